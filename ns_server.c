@@ -0,0 +1,374 @@
+/*
+ * reference name server (see doc/name_server.txt). serves udp and tcp
+ * requests on the same port with one epoll loop, so the whole cluster
+ * can register at once. usage: ns_server peers [port] [linger]
+ * "peers" - number of zerovm instances, "port" - port to listen (0 or
+ * none - any free port, printed upon start), "linger" - seconds to
+ * answer the repeated requests after the replies are sent (default 2)
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PARCEL_SIZE 65507 /* maximum size of an UDP packet */
+#define PARCEL_LIMIT 0x1000000 /* the biggest tcp parcel */
+#define HEADER_SIZE 12 /* node, binds and connects numbers */
+#define RECORD_SIZE 6 /* host and port */
+#define EVENTS 256
+#define LINGER 2
+
+#define FAIL(cond, ...) \
+    do { \
+      if(cond) \
+      { \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, ": %s\n", strerror(errno)); \
+        exit(1); \
+      } \
+    } while(0)
+
+/* bind record of the node: the port "host" node connects to */
+struct Bind {
+  uint32_t host;
+  uint16_t port;
+};
+
+/* registered node */
+struct Peer {
+  uint32_t node;
+  uint32_t ip; /* network order */
+  char *parcel; /* the request, becomes the reply */
+  uint32_t size;
+  struct Bind *binds; /* sorted by host */
+  uint32_t binds_number;
+  int fd; /* tcp connection waiting for the reply or -1 */
+  struct sockaddr_in addr; /* udp address to reply */
+};
+
+/* tcp connection reading the request: size (big endian) and parcel */
+struct Connection {
+  int fd;
+  uint32_t size;
+  uint32_t got;
+  char *buf;
+};
+
+static struct Peer **peers; /* hash table by node id */
+static uint32_t capacity;
+static uint32_t registered;
+static uint32_t expected;
+static int complete;
+static int udp;
+static int epfd;
+
+static uint32_t Get32(const char *p)
+{
+  uint32_t a;
+  memcpy(&a, p, sizeof a);
+  return ntohl(a);
+}
+
+static uint16_t Get16(const char *p)
+{
+  uint16_t a;
+  memcpy(&a, p, sizeof a);
+  return ntohs(a);
+}
+
+/* return the slot of the node in the hash table */
+static struct Peer **Slot(uint32_t node)
+{
+  uint32_t i = (node * 2654435761u) & (capacity - 1);
+
+  while(peers[i] != NULL && peers[i]->node != node)
+    i = (i + 1) & (capacity - 1);
+  return &peers[i];
+}
+
+static int CompareBinds(const void *a, const void *b)
+{
+  uint32_t x = ((const struct Bind*)a)->host;
+  uint32_t y = ((const struct Bind*)b)->host;
+  return x < y ? -1 : x > y;
+}
+
+/* return the port of the "node" bind for the "host" or -1 */
+static int FindPort(struct Peer *node, uint32_t host)
+{
+  struct Bind key;
+  struct Bind *b;
+
+  key.host = host;
+  b = bsearch(&key, node->binds, node->binds_number, sizeof key, CompareBinds);
+  return b == NULL ? -1 : b->port;
+}
+
+/* send the reply to the peer by the way it asked */
+static void Reply(struct Peer *p)
+{
+  if(p->fd < 0)
+  {
+    sendto(udp, p->parcel, p->size, 0, (struct sockaddr*)&p->addr, sizeof p->addr);
+    return;
+  }
+  else
+  {
+    uint32_t size = htonl(p->size);
+    struct iovec iov[2] = {{&size, sizeof size}, {p->parcel, p->size}};
+    struct msghdr msg = {0};
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if(sendmsg(p->fd, &msg, MSG_NOSIGNAL) < 0)
+      fprintf(stderr, "cannot reply %u: %s\n", p->node, strerror(errno));
+    close(p->fd);
+    p->fd = -1;
+  }
+}
+
+/* replace connect records with ip:port of the binds and reply to all */
+static void Resolve()
+{
+  uint32_t i;
+
+  for(i = 0; i < capacity; ++i)
+  {
+    struct Peer *p = peers[i];
+    uint32_t binds;
+    uint32_t connects;
+    uint32_t j;
+
+    if(p == NULL) continue;
+    binds = Get32(p->parcel + 4);
+    connects = Get32(p->parcel + 8);
+    for(j = binds; j < binds + connects; ++j)
+    {
+      char *record = p->parcel + HEADER_SIZE + j * RECORD_SIZE;
+      uint32_t host = Get32(record);
+      struct Peer *h = *Slot(host);
+      int port = h == NULL ? -1 : FindPort(h, p->node);
+      uint16_t nport = htons(port);
+
+      if(port < 0)
+      {
+        fprintf(stderr, "node %u has no bind for node %u\n", host, p->node);
+        exit(1);
+      }
+      memcpy(record, &h->ip, sizeof h->ip);
+      memcpy(record + 4, &nport, sizeof nport);
+    }
+  }
+
+  complete = 1;
+  for(i = 0; i < capacity; ++i)
+    if(peers[i] != NULL) Reply(peers[i]);
+}
+
+/*
+ * register the request. the repeated request only updates the way
+ * to reply and gets the reply at once if the cluster is resolved
+ */
+static void Register(char *parcel, uint32_t size, int fd, struct sockaddr_in *addr)
+{
+  struct Peer **slot;
+  struct Peer *p;
+  uint32_t binds;
+  uint32_t i;
+
+  if(size < HEADER_SIZE || size != HEADER_SIZE
+      + (uint64_t)RECORD_SIZE * (Get32(parcel + 4) + Get32(parcel + 8)))
+  {
+    fprintf(stderr, "invalid parcel of %u bytes\n", size);
+    if(fd >= 0) close(fd);
+    free(parcel);
+    return;
+  }
+
+  slot = Slot(Get32(parcel));
+  p = *slot;
+  if(p != NULL)
+  {
+    if(p->fd >= 0) close(p->fd);
+    p->fd = fd;
+    p->addr = *addr;
+    free(parcel);
+    if(complete) Reply(p);
+    return;
+  }
+
+  /* new node */
+  p = calloc(1, sizeof *p);
+  p->node = Get32(parcel);
+  p->ip = addr->sin_addr.s_addr;
+  p->parcel = parcel;
+  p->size = size;
+  p->fd = fd;
+  p->addr = *addr;
+  binds = Get32(parcel + 4);
+  p->binds = malloc((binds + 1) * sizeof *p->binds);
+  p->binds_number = binds;
+  for(i = 0; i < binds; ++i)
+  {
+    p->binds[i].host = Get32(parcel + HEADER_SIZE + i * RECORD_SIZE);
+    p->binds[i].port = Get16(parcel + HEADER_SIZE + i * RECORD_SIZE + 4);
+  }
+  qsort(p->binds, binds, sizeof *p->binds, CompareBinds);
+  *slot = p;
+
+  if(++registered == expected) Resolve();
+  else if(complete) Reply(p);
+}
+
+static void ReadUDP()
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof addr;
+  char *parcel = malloc(PARCEL_SIZE);
+  ssize_t size = recvfrom(udp, parcel, PARCEL_SIZE, 0, (struct sockaddr*)&addr, &len);
+
+  if(size < 0)
+  {
+    free(parcel);
+    return;
+  }
+  Register(parcel, size, -1, &addr);
+}
+
+/* read the tcp request. register it when it is complete */
+static void ReadTCP(struct Connection *c)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof addr;
+  ssize_t i;
+
+  /* the header */
+  if(c->buf == NULL)
+  {
+    i = recv(c->fd, (char*)&c->size + c->got, sizeof c->size - c->got, 0);
+    if(i <= 0) goto drop;
+    c->got += i;
+    if(c->got < sizeof c->size) return;
+    c->size = ntohl(c->size);
+    if(c->size > PARCEL_LIMIT) goto drop;
+    c->buf = malloc(c->size + 1);
+    c->got = 0;
+    return;
+  }
+
+  /* the parcel */
+  i = recv(c->fd, c->buf + c->got, c->size - c->got, 0);
+  if(i <= 0) goto drop;
+  c->got += i;
+  if(c->got < c->size) return;
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  getpeername(c->fd, (struct sockaddr*)&addr, &len);
+  Register(c->buf, c->size, c->fd, &addr);
+  free(c);
+  return;
+
+drop:
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->buf);
+  free(c);
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in addr = {0};
+  socklen_t len = sizeof addr;
+  struct epoll_event ev;
+  struct epoll_event events[EVENTS];
+  struct Connection listener = {-1, 0, 0, NULL};
+  int linger = argc > 3 ? atoi(argv[3]) : LINGER;
+  int on = 1;
+  int i;
+
+  if(argc < 2 || atoi(argv[1]) < 1)
+  {
+    fprintf(stderr, "usage: %s peers [port] [linger]\n", argv[0]);
+    return 1;
+  }
+  expected = atoi(argv[1]);
+  for(capacity = 1; capacity < expected * 2; capacity <<= 1);
+  peers = calloc(capacity, sizeof *peers);
+
+  /* udp and tcp on the same port */
+  udp = socket(AF_INET, SOCK_DGRAM, 0);
+  listener.fd = socket(AF_INET, SOCK_STREAM, 0);
+  FAIL(udp < 0 || listener.fd < 0, "cannot get socket");
+  setsockopt(udp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  setsockopt(listener.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(argc > 2 ? atoi(argv[2]) : 0);
+  FAIL(bind(udp, (struct sockaddr*)&addr, sizeof addr) < 0, "cannot bind udp");
+  FAIL(getsockname(udp, (struct sockaddr*)&addr, &len) < 0, "cannot get port");
+  FAIL(bind(listener.fd, (struct sockaddr*)&addr, sizeof addr) < 0, "cannot bind tcp");
+  FAIL(listen(listener.fd, SOMAXCONN) < 0, "cannot listen");
+  i = 0x1000000;
+  setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &i, sizeof i);
+  printf("%u\n", ntohs(addr.sin_port));
+  fflush(stdout);
+
+  epfd = epoll_create1(0);
+  FAIL(epfd < 0, "cannot create epoll");
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  FAIL(epoll_ctl(epfd, EPOLL_CTL_ADD, udp, &ev) < 0, "epoll");
+  ev.data.ptr = &listener;
+  FAIL(epoll_ctl(epfd, EPOLL_CTL_ADD, listener.fd, &ev) < 0, "epoll");
+
+  /* serve until resolved, then answer the repeated requests a bit */
+  for(;;)
+  {
+    int n = epoll_wait(epfd, events, EVENTS, complete ? linger * 1000 : -1);
+
+    if(n < 0 && errno == EINTR) continue;
+    FAIL(n < 0, "epoll_wait");
+    if(n == 0) break;
+
+    for(i = 0; i < n; ++i)
+    {
+      struct Connection *c = events[i].data.ptr;
+
+      if(c == NULL)
+        ReadUDP();
+      else if(c == &listener)
+      {
+        int fd = accept(listener.fd, NULL, NULL);
+
+        if(fd < 0) continue;
+        c = calloc(1, sizeof *c);
+        c->fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+      }
+      else
+        ReadTCP(c);
+    }
+  }
+
+  return 0;
+}
@@ -21,6 +21,7 @@
 #include "src/main/accounting.h"
 #include "src/channels/preload.h"
 #include "src/channels/prefetch.h"
+#include "src/channels/compress.h"
 #include "src/channels/nservice.h"
 #include "src/channels/channel.h"
 
@@ -34,6 +35,31 @@ static GTree *aliases;
 static int tree_reset = 0;
 static uint32_t binds = 0; /* "bind" sources number */
 static uint32_t connects = 0; /* "connect" sources number */
+static int unmounted = 0; /* 1st channel waiting for the name service */
+static int local = 0; /* 1st channel without network sources */
+
+/*
+ * striped channel record header. the writer sends the records to the
+ * sources in turn, the reader takes them back in the same order
+ */
+struct StripeHeader {
+  int64_t seq; /* record number */
+  int64_t size; /* record data size */
+};
+
+/* channel striping state (channel->stripe) */
+struct Stripe {
+  int64_t seq; /* the next record number */
+  int64_t rest; /* unread data of the current record */
+  int n; /* the current record source */
+};
+
+/* channel merging state (channel->merge) */
+struct Merge {
+  uint8_t *open; /* sources without eof */
+  int left; /* number of open sources */
+  int n; /* the current message source */
+};
 
 /* if the function called there is duplicate */
 static void DuplicateKey(gpointer key)
@@ -51,37 +77,37 @@ static void ResetAliases()
   aliases = NULL;
 }
 
-/* get chunk of data from source. data will be put to "buffers" */
-static int32_t GetDataChunk(struct ChannelDesc *channel, int n,
-    size_t size, off_t offset)
+/* read chunk of data from source to "buf" */
+static int32_t ReadSource(struct ChannelDesc *channel, int n,
+    char *buf, size_t size, off_t offset)
 {
   int32_t result = 0;
 
   switch(CH_PROTO(channel, n))
   {
     case ProtoRegular:
-      result = pread(GPOINTER_TO_INT(CH_HANDLE(channel, n)),
-          buffers->pdata[n], size, offset);
+      result = pread(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buf, size, offset);
       if(result == -1) result = -errno;
       break;
     case ProtoCharacter:
     case ProtoFIFO:
-      result = fread(buffers->pdata[n], 1, size, CH_HANDLE(channel, n));
+      result = fread(buf, 1, size, CH_HANDLE(channel, n));
       if(result == -1) result = -errno;
       break;
     case ProtoTCP:
+    case ProtoUDT:
+    case ProtoNTCP:
+    case ProtoSHM:
+    case ProtoIPC:
       /* get another message if it already exhausted */
       if(channel->bufend - channel->bufpos == 0)
-      {
-        channel->bufpos = size; /* workaround for udt to get full message */
-        FetchMessage(channel, n);
-      }
+        FetchMessage(channel, n, size);
 
       /* copy data from the message to buffers */
       if(channel->eof == 0)
       {
         result = MIN(size, channel->bufend - channel->bufpos);
-        memcpy(buffers->pdata[n], MessageData(channel) + channel->bufpos, result);
+        memcpy(buf, MessageData(channel) + channel->bufpos, result);
         channel->bufpos += result;
       }
       break;
@@ -89,6 +115,165 @@ static int32_t GetDataChunk(struct ChannelDesc *channel, int n,
       ZLOGFAIL(1, EFAULT, "invalid channel source %s;n", channel->alias, n);
       break;
   }
+  return result;
+}
+
+/*
+ * get eof from all sources but "n" (already has it). the eof message of
+ * "n" (digest) must be put aside, all sources must end with the same
+ * digest. the last one is left for TestEOFDigest()
+ */
+static void EndStripes(struct ChannelDesc *channel, int n)
+{
+  struct StripeHeader h;
+  char digest[TAG_DIGEST_SIZE];
+  int32_t size = channel->bufend;
+  int i;
+
+  ZLOGFAIL(size > TAG_DIGEST_SIZE, EPIPE, "%s;%d has invalid eof",
+      channel->alias, n);
+  if(size > 0) memcpy(digest, MessageData(channel), size);
+
+  for(i = 0; i < channel->source->len; ++i)
+  {
+    if(i == n) continue;
+    channel->eof = 0;
+    channel->bufpos = channel->bufend = 0;
+    ZLOGFAIL(ReadSource(channel, i, (char*)&h, sizeof h, 0) != 0, EPIPE,
+        "%s;%d has extra stripe", channel->alias, i);
+    ZLOGFAIL(channel->bufend != size || (size > 0
+        && memcmp(MessageData(channel), digest, size) != 0), EPIPE,
+        "%s;%d corrupted upon eof", channel->alias, i);
+  }
+  channel->eof = 1;
+}
+
+/* read chunk of striped data. take the next record header if needed */
+static int32_t ReadStriped(struct ChannelDesc *channel, char *buf, size_t size)
+{
+  struct Stripe *s = channel->stripe;
+  struct StripeHeader h;
+  int32_t result;
+
+  if(s->rest == 0)
+  {
+    /* the previous record must be consumed up to the message end */
+    ZLOGFAIL(channel->bufpos != channel->bufend, EPIPE,
+        "%s;%d has misaligned stripe", channel->alias, s->n);
+    s->n = s->seq % channel->source->len;
+    result = ReadSource(channel, s->n, (char*)&h, sizeof h, 0);
+    if(result == 0)
+    {
+      EndStripes(channel, s->n);
+      return 0;
+    }
+
+    ZLOGFAIL(result != sizeof h || h.size <= 0, EPIPE,
+        "%s;%d has corrupted stripe", channel->alias, s->n);
+    ZLOGFAIL(h.seq != s->seq, EPIPE, "%s;%d has stripe %ld instead of %ld",
+        channel->alias, s->n, h.seq, s->seq);
+    ++s->seq;
+    s->rest = h.size;
+  }
+
+  result = ReadSource(channel, s->n, buf, MIN(size, s->rest), 0);
+  ZLOGFAIL(result <= 0, EPIPE, "%s;%d has truncated stripe", channel->alias, s->n);
+  s->rest -= result;
+  return result;
+}
+
+/* read chunk of merged data. take a message of any source if needed */
+static int32_t ReadMerged(struct ChannelDesc *channel, char *buf, size_t size)
+{
+  struct Merge *m = channel->merge;
+  int32_t result;
+
+  while(channel->bufpos == channel->bufend)
+  {
+    /* no digest check: the merged data is not the data of any source */
+    if(m->left == 0)
+    {
+      channel->eof = 1;
+      channel->bufend = 0;
+      return 0;
+    }
+
+    m->n = PollSources(channel, m->open, m->n + 1);
+    channel->eof = 0;
+    FetchMessage(channel, m->n, size);
+    if(!channel->eof) continue;
+
+    m->open[m->n] = 0;
+    --m->left;
+    channel->bufpos = channel->bufend = 0;
+  }
+
+  result = MIN(size, channel->bufend - channel->bufpos);
+  memcpy(buf, MessageData(channel) + channel->bufpos, result);
+  channel->bufpos += result;
+  return result;
+}
+
+/* read chunk of data from the source, the stripes or the merged sources */
+static int32_t ReadChunk(struct ChannelDesc *channel, int n,
+    char *buf, size_t size, off_t offset)
+{
+  if(channel->stripe != NULL)
+    return ReadStriped(channel, buf, size);
+  if(channel->merge != NULL)
+    return ReadMerged(channel, buf, size);
+  return ReadSource(channel, n, buf, size, offset);
+}
+
+/* read "size" bytes of compressed stream (less only upon EOF) */
+static int32_t ReadPacked(struct ChannelDesc *channel, int n,
+    char *buf, int32_t size)
+{
+  struct Codec *c = channel->codec;
+  int32_t done;
+  int32_t result;
+
+  for(done = 0; done < size; done += result)
+  {
+    result = ReadChunk(channel, n, buf + done, size - done, c->offset);
+    if(result < 0) return result;
+    if(result == 0) break;
+    c->offset += result;
+  }
+  return done;
+}
+
+/* get chunk of uncompressed data. read the next frame if needed */
+static int32_t Unpack(struct ChannelDesc *channel, int n, size_t size)
+{
+  struct Codec *c = channel->codec;
+  struct Frame *f = (struct Frame*)c->frame;
+  int32_t result;
+
+  if(c->pos == c->size)
+  {
+    result = ReadPacked(channel, n, c->frame, sizeof *f);
+    if(result <= 0) return result;
+    ZLOGFAIL(result != sizeof *f || FRAME_SIZE(f) > COMPRESS_BLOCK, EPIPE,
+        "%s;%d has corrupted compressed frame", channel->alias, n);
+    result = ReadPacked(channel, n, c->frame + sizeof *f, FRAME_SIZE(f));
+    ZLOGFAIL(result != (int32_t)FRAME_SIZE(f) || !DecompressFrame(c), EPIPE,
+        "%s;%d has corrupted compressed frame", channel->alias, n);
+  }
+
+  result = MIN(size, c->size - c->pos);
+  memcpy(buffers->pdata[n], c->block + c->pos, result);
+  c->pos += result;
+  return result;
+}
+
+/* get chunk of data from source. data will be put to "buffers" */
+static int32_t GetDataChunk(struct ChannelDesc *channel, int n,
+    size_t size, off_t offset)
+{
+  int32_t result = channel->codec == NULL
+      ? ReadChunk(channel, n, buffers->pdata[n], size, offset)
+      : Unpack(channel, n, size);
 
   /* update the source position */
   if(result > 0)
@@ -144,6 +329,10 @@ int32_t ChannelRead(struct ChannelDesc *channel,
   int toread;
   int n;
 
+  /* the stripes and the merged sources make one source */
+  int replicas = channel->stripe == NULL && channel->merge == NULL
+      ? channel->source->len : 1;
+
   assert(buffers != NULL);
   assert(channel != NULL);
   assert(channel->source->len > 0);
@@ -156,7 +345,7 @@ int32_t ChannelRead(struct ChannelDesc *channel,
     good = -1;
 
     ZLOGFAIL(first < 0, EIO, "all %s sources failed", channel->alias);
-    for(n = first; n < channel->source->len && good < 0 && !channel->eof; ++n)
+    for(n = first; n < replicas && good < 0 && !channel->eof; ++n)
     {
       int j;
 
@@ -190,9 +379,9 @@ int32_t ChannelRead(struct ChannelDesc *channel,
     }
 
     /* fail session if chunk broken and cannot be restored */
-    ZLOGFAIL(!channel->eof && good < 0 && channel->source->len > 1,
+    ZLOGFAIL(!channel->eof && good < 0 && replicas > 1,
         EIO, "%s failed to read", channel->alias);
-    ZLOGFAIL(result < 0 && channel->source->len == 1,
+    ZLOGFAIL(result < 0 && replicas == 1,
         EIO, "%s failed to read", channel->alias);
 
     /* copy verified data to buffer and shift the position */
@@ -224,36 +413,132 @@ int32_t ChannelRead(struct ChannelDesc *channel,
   return result;
 }
 
-int32_t ChannelWrite(struct ChannelDesc *channel,
+/* write data to the source. return written size */
+static int32_t WriteSource(struct ChannelDesc *channel, int n,
     const char *buffer, size_t size, off_t offset)
 {
-  int n;
   int32_t result = -1;
 
-  for(n = 0; n < channel->source->len; ++n)
+  switch(CH_PROTO(channel, n))
   {
-    switch(CH_PROTO(channel, n))
-    {
-      case ProtoRegular:
-        result = pwrite(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buffer, size, offset);
-        break;
-      case ProtoCharacter:
-      case ProtoFIFO:
-        result = fwrite(buffer, 1, size, CH_HANDLE(channel, n));
-        break;
-      case ProtoTCP:
-        result = SendData(channel, n, buffer, size);
-        break;
-      default: /* design error */
-        ZLOGFAIL(1, EFAULT, "invalid channel source %s;%d", channel->alias, n);
-        break;
-    }
+    case ProtoRegular:
+      PreloadGrow(channel, n, offset + size);
+      result = pwrite(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buffer, size, offset);
+      break;
+    case ProtoCharacter:
+    case ProtoFIFO:
+      result = fwrite(buffer, 1, size, CH_HANDLE(channel, n));
+      break;
+    case ProtoTCP:
+    case ProtoUDT:
+    case ProtoNTCP:
+    case ProtoSHM:
+    case ProtoIPC:
+      result = SendData(channel, n, buffer, size);
+      break;
+    default: /* design error */
+      ZLOGFAIL(1, EFAULT, "invalid channel source %s;%d", channel->alias, n);
+      break;
+  }
+
+  /* accounting */
+  ZLOGFAIL(result < 0, EIO, "%s;%d failed to write: %s",
+      channel->alias, n, strerror(errno));
+  CountPut(CH_CONN(channel, n), result);
+  return result;
+}
 
-    /* accounting */
-    ZLOGFAIL(result < 0, EIO, "%s;%d failed to write: %s",
-        channel->alias, n, strerror(errno));
+/*
+ * spread the data over the sources by records, one source in turn. the
+ * header and the data go as separate messages, so the data is sent from
+ * the user buffer (zero copy if the transport can)
+ */
+static int32_t WriteStriped(struct ChannelDesc *channel,
+    const char *buffer, size_t size)
+{
+  struct Stripe *s = channel->stripe;
+  struct StripeHeader h;
+  size_t done;
+
+  for(done = 0; done < size; done += h.size)
+  {
+    int n = s->seq % channel->source->len;
+
+    h.seq = s->seq++;
+    h.size = MIN(channel->options[OptMsgSize], size - done);
+    WriteSource(channel, n, (char*)&h, sizeof h, 0);
+    WriteSource(channel, n, buffer + done, h.size, 0);
+  }
+  return size;
+}
+
+/* send data to all sources at once. return written size */
+static int32_t WriteBroadcast(struct ChannelDesc *channel,
+    const char *buffer, size_t size)
+{
+  int n;
+  int32_t result = BroadcastData(channel, buffer, size);
+
+  ZLOGFAIL(result < 0, EIO, "%s failed to broadcast: %s",
+      channel->alias, strerror(errno));
+  for(n = 0; n < channel->source->len; ++n)
     CountPut(CH_CONN(channel, n), result);
+  return result;
+}
+
+/* write data to all sources or to the stripes. return written size */
+static int32_t WriteData(struct ChannelDesc *channel,
+    const char *buffer, size_t size, off_t offset)
+{
+  int n;
+  int32_t result = size;
+
+  if(channel->stripe != NULL)
+    return WriteStriped(channel, buffer, size);
+  if(channel->options[OptMode] == ModeBroadcast)
+    return WriteBroadcast(channel, buffer, size);
+
+  for(n = 0; n < channel->source->len; ++n)
+    result = WriteSource(channel, n, buffer, size, offset);
+  return result;
+}
+
+/* compress accumulated data and write the frame */
+static void PutFrame(struct ChannelDesc *channel)
+{
+  struct Codec *c = channel->codec;
+  int32_t size = CompressFrame(c);
+
+  WriteData(channel, c->frame, size, c->offset);
+  c->offset += size;
+}
+
+/* accumulate data to compress. write full blocks */
+static void Pack(struct ChannelDesc *channel, const char *buffer, size_t size)
+{
+  struct Codec *c = channel->codec;
+
+  while(size > 0)
+  {
+    int32_t chunk = MIN(size, COMPRESS_BLOCK - c->size);
+
+    memcpy(c->block + c->size, buffer, chunk);
+    c->size += chunk;
+    buffer += chunk;
+    size -= chunk;
+    if(c->size == COMPRESS_BLOCK) PutFrame(channel);
   }
+}
+
+int32_t ChannelWrite(struct ChannelDesc *channel,
+    const char *buffer, size_t size, off_t offset)
+{
+  int32_t result = size;
+
+  if(channel->codec != NULL)
+    Pack(channel, buffer, size);
+  else
+    result = WriteData(channel, buffer, size, offset);
 
   /* update cursors and size */
   channel->putpos = offset + result;
@@ -362,6 +647,90 @@ static void GetNetworkStatistics(const struct Manifest *manifest)
     CountNetSources(CH_CH(manifest, i), &binds, &connects);
 }
 
+/* prepare striping */
+static void StripeCtor(struct ChannelDesc *channel)
+{
+  struct Stripe *s;
+
+  ZLOGFAIL(channel->options[OptBatch] != 0, EFAULT,
+      "%s: striped channel cannot be batched", channel->alias);
+  ZLOGFAIL(channel->options[OptMsgSize] < sizeof(struct StripeHeader),
+      EFAULT, "%s: too small message for stripes", channel->alias);
+
+  s = g_malloc0(sizeof *s);
+  channel->stripe = s;
+}
+
+/* prepare merging. all sources are open */
+static void MergeCtor(struct ChannelDesc *channel)
+{
+  struct Merge *m = g_malloc0(sizeof *m);
+
+  m->open = g_malloc(channel->source->len);
+  memset(m->open, 1, channel->source->len);
+  m->left = channel->source->len;
+  m->n = -1;
+  channel->merge = m;
+}
+
+/* check the channel can work in the asked mode and prepare the mode */
+static void ModeCtor(struct ChannelDesc *channel)
+{
+  int64_t mode = channel->options[OptMode];
+  int i;
+
+  if(mode == ModeReplica) return;
+
+  ZLOGFAIL(mode < 0 || mode >= ChannelModesNumber, EFAULT,
+      "%s has invalid mode %ld", channel->alias, mode);
+  ZLOGFAIL(channel->type != SGetSPut || IS_RW(channel), EFAULT,
+      "%s: mode %ld needs sequential read only or write only channel",
+      channel->alias, mode);
+  ZLOGFAIL(mode == ModeBroadcast && !IS_WO(channel), EFAULT,
+      "%s: broadcast channel must be write only", channel->alias);
+  ZLOGFAIL(mode == ModeMerge && !IS_RO(channel), EFAULT,
+      "%s: merged channel must be read only", channel->alias);
+  for(i = 0; i < channel->source->len; ++i)
+    ZLOGFAIL(!IS_NETWORK(CH_CONN(channel, i)), EFAULT,
+        "%s: mode %ld needs network sources only", channel->alias, mode);
+
+  if(mode == ModeStripe) StripeCtor(channel);
+  if(mode == ModeMerge) MergeCtor(channel);
+}
+
+/* release the channel striping and merging states */
+static void ModeDtor(struct ChannelDesc *channel)
+{
+  struct Stripe *s = channel->stripe;
+  struct Merge *m = channel->merge;
+
+  if(s != NULL)
+  {
+    g_free(s);
+    channel->stripe = NULL;
+  }
+
+  if(m != NULL)
+  {
+    g_free(m->open);
+    g_free(m);
+    channel->merge = NULL;
+  }
+}
+
+/*
+ * striped and merged sources are not in sync with the channel position.
+ * tell the source destructor whether the source has reached eof, if not
+ * the destructor will stop (or skip) the rest of the source data
+ */
+static void SourceEOF(struct ChannelDesc *channel, int n, int8_t eof)
+{
+  struct Merge *m = channel->merge;
+
+  CH_CONN(channel, n)->pos = channel->getpos;
+  channel->eof = m == NULL ? eof : !m->open[n];
+}
+
 /* mount the channel sources */
 static void ChannelCtor(struct ChannelDesc *channel)
 {
@@ -386,6 +755,10 @@ static void ChannelCtor(struct ChannelDesc *channel)
   if(IS_RO(channel))
     g_ptr_array_sort(channel->source, (GCompareFunc)OrderSources);
 
+  /* prepare the channel mode and compression if asked */
+  ModeCtor(channel);
+  CodecCtor(channel);
+
   /* update "buffers" size for "read" channels */
   if(IS_RO(channel) || IS_RW(channel))
     if(channel->source->len > buffers_size)
@@ -395,6 +768,7 @@ static void ChannelCtor(struct ChannelDesc *channel)
 /* close channel and deallocate its resources */
 static void ChannelDtor(struct ChannelDesc *channel)
 {
+  int8_t eof;
   int i;
 
   assert(channel != NULL);
@@ -402,27 +776,44 @@ static void ChannelDtor(struct ChannelDesc *channel)
   /* quit if channel isn't mounted (no handles added) */
   if(channel->source->len == 0) return;
 
+  /* write the rest of compressed data */
+  if(channel->codec != NULL && IS_WO(channel) && GetExitCode() == 0)
+    if(((struct Codec*)channel->codec)->size > 0) PutFrame(channel);
+
   /* free channel */
+  eof = channel->eof;
   for(i = 0; i < channel->source->len; ++i)
     if(IS_FILE(CH_FILE(channel, i)))
       PreloadChannelDtor(channel, i);
     else
+    {
+      if(channel->stripe != NULL || channel->merge != NULL)
+        if(IS_RO(channel)) SourceEOF(channel, i, eof);
       PrefetchChannelDtor(channel, i);
+    }
 
   /*
    * message cannot be safely deallocated until 0mq context closed
    * since message can still be in use
    */
   FreeMessage(channel);
+  CodecDtor(channel);
+  ModeDtor(channel);
 }
 
-void ChannelsCtor(struct Manifest *manifest)
+/* return 1 if the channel has no network sources */
+static int IsLocal(const struct ChannelDesc *channel)
 {
-  int i = 0;
+  uint32_t b = 0;
+  uint32_t c = 0;
 
-#ifdef udt /* TODO(d'b): remove it after "channels" re-design */
-  extern void PrefetchAccept(struct ChannelDesc *channel);
-#endif
+  CountNetSources(channel, &b, &c);
+  return b + c == 0;
+}
+
+void ChannelsMount(struct Manifest *manifest)
+{
+  int i = 0;
 
   /* allocate list to detect duplicate channels aliases */
   assert(manifest != NULL);
@@ -451,19 +842,31 @@ void ChannelsCtor(struct Manifest *manifest)
   while(IS_RO(CH_CH(manifest, i)))
     ChannelCtor(CH_CH(manifest, i++));
 
-  /* ask for name service */
+  /* ask for name service. the answer is waited in ChannelsJoin() */
   NameServiceCtor(manifest, binds, connects);
-  NameServiceDtor();
 
-  /* mount the rest of channels */
-  for(; i < manifest->channels->len; ++i)
+  /* local channels are sorted to the end. mount them meanwhile */
+  for(unmounted = i; i < manifest->channels->len; ++i)
+    if(IsLocal(CH_CH(manifest, i))) break;
+  for(local = i; i < manifest->channels->len; ++i)
+    ChannelCtor(CH_CH(manifest, i));
+}
+
+void ChannelsJoin(struct Manifest *manifest)
+{
+  int i;
+
+  assert(manifest != NULL);
+
+  /* wait for name service and mount the rest of channels */
+  NameServiceDtor(manifest);
+  for(i = unmounted; i < local; ++i)
     ChannelCtor(CH_CH(manifest, i));
 
-#ifdef udt /* TODO(d'b): remove it after "channels" re-design */
   /* accept after binds (to avoid hanging on accept) */
-  for(i = 0; i < manifest->channels->len; ++i)
-    PrefetchAccept(CH_CH(manifest, i));
-#endif
+  if(binds + connects > 0)
+    for(i = 0; i < manifest->channels->len; ++i)
+      PrefetchAccept(CH_CH(manifest, i));
 
   /* reorder channels for user manifest */
   SortChannels(manifest->channels);
@@ -481,6 +884,12 @@ void ChannelsCtor(struct Manifest *manifest)
     g_ptr_array_add(buffers, g_malloc(BUFFER_SIZE));
 }
 
+void ChannelsCtor(struct Manifest *manifest)
+{
+  ChannelsMount(manifest);
+  ChannelsJoin(manifest);
+}
+
 void ChannelsDtor(struct Manifest *manifest)
 {
   int i;
@@ -493,7 +902,7 @@ void ChannelsDtor(struct Manifest *manifest)
   for(i = 0; i < manifest->channels->len; ++i)
   {
     struct ChannelDesc *channel = CH_CH(manifest, i);
-    ReportTag(channel->alias, channel->tag);
+    ReportChannel(channel);
     ChannelDtor(channel);
   }
   ResetAliases();
@@ -64,6 +64,24 @@ EXTERN_C_BEGIN
 #define CH_PORT(channel, n) (CH_CONN(channel, n))->port
 #define CH_BACKUP(channel, n) (CH_CONN(channel, n))->backup
 
+/* channel modes ("Mode" channel option values) */
+enum ChannelModes {
+  ModeReplica, /* every source has the whole data */
+  ModeStripe, /* the data is spread over the sources */
+  ModeBroadcast, /* write only: the sources share the sent messages */
+  ModeMerge, /* read only: messages of all sources in arrival order */
+  ChannelModesNumber
+};
+
+/* write only regular files space preallocation ("Prealloc" option values) */
+enum PreallocModes {
+  PreallocGrow, /* reserve the space ahead of writes, doubling it */
+  PreallocNone, /* no preallocation */
+  PreallocLimit, /* reserve the whole PutSizeLimit at once */
+  PreallocTruncate, /* extend the (sparse) file to PutSizeLimit */
+  PreallocModesNumber
+};
+
 #define CH_SEQ_READABLE(channel) (((channel)->type & 1) == 0)
 #define CH_SEQ_WRITEABLE(channel) (((channel)->type & 2) == 0)
 #define CH_RND_READABLE(channel) (((channel)->type & 1) == 1)
@@ -72,6 +90,15 @@ EXTERN_C_BEGIN
 /* sort channels */
 void SortChannels(GPtrArray *channels);
 
+/*
+ * mount RO and local channels and start the name service. network
+ * channels are mounted by ChannelsJoin() when the name service answers
+ */
+void ChannelsMount(struct Manifest *manifest);
+
+/* wait for the name service, mount the rest of channels and sort them */
+void ChannelsJoin(struct Manifest *manifest);
+
 /* construct all channels, initialize it and update system_manifest */
 void ChannelsCtor(struct Manifest *manifest);
 
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <glib.h>
+#ifdef COMPRESS_lz4
+#include <lz4.h>
+#endif
+#ifdef COMPRESS_zstd
+#include <zstd.h>
+#endif
+#include "src/channels/channel.h"
+#include "src/channels/compress.h"
+
+#define ZSTD_DEFAULT_LEVEL 3
+#define FRAME_DATA(c) ((c)->frame + sizeof(struct Frame))
+
+/* return 1 if the method is built in */
+static int Available(int method)
+{
+  switch(method)
+  {
+#ifdef COMPRESS_lz4
+    case CompressLZ4:
+      return 1;
+#endif
+#ifdef COMPRESS_zstd
+    case CompressZstd:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+void CodecCtor(struct ChannelDesc *channel)
+{
+  struct Codec *c;
+  int method = channel->options[OptCompress];
+
+  if(method == CompressNone) return;
+
+  ZLOGFAIL(!Available(method), EFAULT,
+      "%s: compression method %d is not available", channel->alias, method);
+  ZLOGFAIL(channel->type != SGetSPut || IS_RW(channel), EFAULT,
+      "%s: compression needs sequential read only or write only channel",
+      channel->alias);
+  ZLOGFAIL(IS_RO(channel) && channel->source->len > 1
+      && channel->stripe == NULL, EFAULT,
+      "%s: compressed read only channel must have one source", channel->alias);
+
+  c = g_malloc0(sizeof *c);
+  c->method = method;
+  c->level = channel->options[OptCompressLevel];
+  c->block = g_malloc(COMPRESS_BLOCK);
+  c->frame = g_malloc(sizeof(struct Frame) + COMPRESS_BLOCK);
+  channel->codec = c;
+}
+
+void CodecDtor(struct ChannelDesc *channel)
+{
+  struct Codec *c = channel->codec;
+
+  if(c == NULL) return;
+  g_free(c->block);
+  g_free(c->frame);
+  g_free(c);
+  channel->codec = NULL;
+}
+
+/*
+ * compress the block to the frame data not bigger than the block.
+ * return the compressed size or 0 if the block is incompressible
+ */
+static int32_t Compress(struct Codec *c)
+{
+  switch(c->method)
+  {
+#ifdef COMPRESS_lz4
+    case CompressLZ4:
+      return LZ4_compress_fast(c->block, FRAME_DATA(c),
+          c->size, c->size - 1, MAX(c->level, 1));
+#endif
+#ifdef COMPRESS_zstd
+    case CompressZstd:
+      {
+        size_t result = ZSTD_compress(FRAME_DATA(c), c->size - 1, c->block,
+            c->size, c->level == 0 ? ZSTD_DEFAULT_LEVEL : c->level);
+        return ZSTD_isError(result) ? 0 : result;
+      }
+#endif
+    default:
+      return 0;
+  }
+}
+
+int32_t CompressFrame(struct Codec *codec)
+{
+  struct Frame *f = (struct Frame*)codec->frame;
+  int32_t packed;
+
+  assert(codec->size > 0 && codec->size <= COMPRESS_BLOCK);
+
+  /* store the block as is if it does not shrink */
+  packed = Compress(codec);
+  if(packed > 0)
+    f->packed = packed | codec->method << 28;
+  else
+  {
+    memcpy(FRAME_DATA(codec), codec->block, codec->size);
+    f->packed = packed = codec->size;
+  }
+
+  f->raw = codec->size;
+  codec->size = 0;
+  return sizeof *f + packed;
+}
+
+int DecompressFrame(struct Codec *codec)
+{
+  struct Frame *f = (struct Frame*)codec->frame;
+  int32_t result = -1;
+
+  if(f->raw > COMPRESS_BLOCK || FRAME_SIZE(f) > COMPRESS_BLOCK) return 0;
+
+  switch(FRAME_METHOD(f))
+  {
+    case CompressNone:
+      memcpy(codec->block, FRAME_DATA(codec), FRAME_SIZE(f));
+      result = FRAME_SIZE(f);
+      break;
+#ifdef COMPRESS_lz4
+    case CompressLZ4:
+      result = LZ4_decompress_safe(FRAME_DATA(codec), codec->block,
+          FRAME_SIZE(f), COMPRESS_BLOCK);
+      break;
+#endif
+#ifdef COMPRESS_zstd
+    case CompressZstd:
+      {
+        size_t size = ZSTD_decompress(codec->block, COMPRESS_BLOCK,
+            FRAME_DATA(codec), FRAME_SIZE(f));
+        result = ZSTD_isError(size) ? -1 : size;
+      }
+      break;
+#endif
+    default:
+      break;
+  }
+
+  codec->size = MAX(result, 0);
+  codec->pos = 0;
+  return result == (int32_t)f->raw;
+}
@@ -0,0 +1,81 @@
+/*
+ * transparent compression of the sequential channels data
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include "src/main/manifest.h"
+
+EXTERN_C_BEGIN
+
+/* the biggest uncompressed frame */
+#define COMPRESS_BLOCK 0x100000
+
+/* compression methods ("Compress" channel option values) */
+enum CompressMethods {
+  CompressNone,
+  CompressLZ4,
+  CompressZstd,
+  CompressMethodsNumber
+};
+
+/*
+ * frame header. the compressed stream is a sequence of frames: header
+ * and data. "packed" contains the data size and the method (high 4 bits),
+ * incompressible data is stored with CompressNone method
+ */
+struct Frame {
+  uint32_t raw; /* uncompressed size */
+  uint32_t packed;
+};
+
+#define FRAME_METHOD(f) ((f)->packed >> 28)
+#define FRAME_SIZE(f) ((f)->packed & 0xfffffff)
+
+/* channel compression state (channel->codec) */
+struct Codec {
+  int method;
+  int level;
+  char *block; /* uncompressed data */
+  int32_t size; /* uncompressed data size */
+  int32_t pos; /* uncompressed data consumed (read) */
+  char *frame; /* compressed frame with header */
+  int64_t offset; /* compressed stream position */
+};
+
+/* construct the channel codec if the channel asks for compression */
+void CodecCtor(struct ChannelDesc *channel);
+
+/* release the channel codec */
+void CodecDtor(struct ChannelDesc *channel);
+
+/*
+ * compress the codec block to the codec frame. return the frame
+ * size (with header). the block becomes empty
+ */
+int32_t CompressFrame(struct Codec *codec);
+
+/*
+ * decompress the codec frame (header already there, data follows it)
+ * to the codec block. return 0 if the frame is corrupted
+ */
+int DecompressFrame(struct Codec *codec);
+
+EXTERN_C_END
+
+#endif /* COMPRESS_H_ */
@@ -16,6 +16,8 @@
 #include <arpa/inet.h> /* ip <-> int */
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include "src/channels/channel.h"
 #include "src/channels/nservice.h"
 
@@ -31,8 +33,10 @@
 #include <byteswap.h>
 #endif
 
-#define RETRY 3 /* poll retries */
-#define TIMEOUT 1200000 /* poll timeout in microseconds */
+#define UDP_RETRY 6 /* udp poll retries before tcp fallback */
+#define UDP_TIMEOUT 100000 /* 1st udp poll timeout in microseconds */
+#define UDP_TIMEOUT_LIMIT (UDP_TIMEOUT << (UDP_RETRY - 1)) /* the longest one */
+#define TCP_TIMEOUT 60 /* tcp poll timeout in seconds */
 #define PARCEL_SIZE 65507 /* maximum size of an UDP packet */
 
 /*
@@ -58,6 +62,23 @@ struct NSParcel
 };
 #pragma pack(pop)
 
+/*
+ * the name server exchange runs in the background while zerovm mounts
+ * local channels and allocates user memory. the exchange thread does not
+ * log and does not fail: the results are checked by NameServiceDtor()
+ */
+static pthread_t exchange;
+static int started = 0;
+static const struct Connection *server = NULL;
+static char *parcel = NULL;
+static uint32_t psize = 0;
+static uint32_t sources = 0;
+static int32_t received = -1;
+static int retries = 0;
+static int fallback = 0;
+static int error = 0;
+static time_t deadline = 0; /* the session timeout */
+
 /* get next bind/connect source */
 #define NEXT_SRC() \
     do { \
@@ -68,7 +89,7 @@ struct NSParcel
         n = 0; \
         continue; \
       } \
-    } while(c->protocol != ProtoTCP && IS_IPHOST(c))
+    } while(IS_FILE(c) && IS_IPHOST(c))
 
 /* serialize channels data to the parcel. return parcel and its "size" */
 static void *ParcelCtor(const struct Manifest *manifest,
@@ -128,55 +149,137 @@ static int ParcelDtor(struct Manifest *manifest, char *parcel)
 #undef NEXT_SRC
 
 /*
- * send the parcel to the name server and get it back
- * return the received parcel size
+ * send the parcel to the name server over udp and get it back making
+ * "count" tries. poll timeout starts with "delay" and doubles with each
+ * retry, so the small clusters resolve fast and the big ones do not flood
+ * the name server with the repeated requests. return the received parcel
+ * size or -1
  */
-static int32_t PollServer(const struct Connection *server, char *parcel, uint32_t size)
+static int32_t PollUDP(const struct Connection *server, char *parcel,
+    uint32_t size, int64_t delay, int count)
 {
-  int i;
   int s;
-  int32_t result;
+  int i;
+  int32_t result = -1;
   struct sockaddr_in addr;
   uint32_t len = sizeof addr;
-  struct timeval timeout = {TIMEOUT / MICRO_PER_SEC, TIMEOUT % MICRO_PER_SEC};
 
   /* connect to the name server */
   s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if(s == -1) return -1;
   addr.sin_addr.s_addr = server->host;
   addr.sin_port = bswap_16(server->port);
   addr.sin_family = AF_INET;
 
-  /* set timeout on socket i/o */
-  result = setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof timeout);
-  ZLOGFAIL(result == -1, errno, "cannot set receiving timeout");
-  result = setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof timeout);
-  ZLOGFAIL(result == -1, errno, "cannot set sending timeout");
-
   /* poll server */
-  for(i = 0; i < RETRY; ++i)
+  for(i = 0; i < count; ++i, ++retries, delay *= 2)
   {
+    struct timeval timeout = {delay / MICRO_PER_SEC, delay % MICRO_PER_SEC};
+
+    /* set timeout on socket i/o */
+    if(setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof timeout)
+        || setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof timeout))
+      break;
+
     result = sendto(s, parcel, size, 0, &addr, sizeof addr);
     if(result < 0) continue;
     result = recvfrom(s, parcel, size, 0, &addr, &len);
     if(result > 0) break;
   }
 
-  ZLOGIF(i && result > 0, "name service polled with %d retries", i);
-  ZLOGFAIL(result == -1, errno, "name service failed");
+  close(s);
+  return result > 0 ? result : -1;
+}
+
+/* send or receive the whole buffer. return 0 on failure */
+static int Transfer(int s, char *buf, uint32_t size, int receive)
+{
+  while(size > 0)
+  {
+    ssize_t result = receive
+        ? recv(s, buf, size, 0) : send(s, buf, size, MSG_NOSIGNAL);
+
+    if(result <= 0) return 0;
+    buf += result;
+    size -= result;
+  }
+  return 1;
+}
+
+/*
+ * send the parcel to the name server over tcp and get it back. the
+ * parcel is preceded with its size (4 bytes big endian) both ways.
+ * return the received parcel size or -1
+ */
+static int32_t PollTCP(const struct Connection *server, char *parcel, uint32_t size)
+{
+  int s;
+  int32_t result = -1;
+  uint32_t header = bswap_32(size);
+  struct sockaddr_in addr;
+  struct timeval timeout = {TCP_TIMEOUT, 0};
+
+  s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if(s == -1) return -1;
+  addr.sin_addr.s_addr = server->host;
+  addr.sin_port = bswap_16(server->port);
+  addr.sin_family = AF_INET;
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof timeout);
+  setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof timeout);
+
+  /* the reply of unexpected size is returned to be reported */
+  if(connect(s, (void*)&addr, sizeof addr) == 0
+      && Transfer(s, (char*)&header, sizeof header, 0)
+      && Transfer(s, parcel, size, 0)
+      && Transfer(s, (char*)&header, sizeof header, 1))
+  {
+    header = bswap_32(header);
+    if(header != size || Transfer(s, parcel, size, 1))
+      result = header;
+  }
+
   close(s);
   return result;
 }
 
+/*
+ * exchange the parcel with the name server: udp first, then tcp if
+ * the parcel does not fit udp packet or udp gets no reply. udp only
+ * name server (ns_server.py) refuses tcp: then udp is polled with the
+ * longest timeout until the session timeout
+ */
+static void *PollServer(void *arg)
+{
+  int refused = 0;
+
+  if(psize <= PARCEL_SIZE)
+    received = PollUDP(server, parcel, psize, UDP_TIMEOUT, UDP_RETRY);
+
+  if(received == -1)
+  {
+    fallback = 1;
+    received = PollTCP(server, parcel, psize);
+    refused = received == -1 && errno == ECONNREFUSED && psize <= PARCEL_SIZE;
+  }
+
+  while(refused && received == -1 && time(NULL) < deadline)
+  {
+    fallback = 0;
+    received = PollUDP(server, parcel, psize, UDP_TIMEOUT_LIMIT, 1);
+  }
+
+  error = errno;
+  return NULL;
+}
+
 void NameServiceCtor(struct Manifest *manifest, uint32_t b, uint32_t c)
 {
-  char *parcel;
-  uint32_t psize;
-  uint32_t control_psize;
-  uint32_t control_nsources;
+  sigset_t all;
+  sigset_t old;
+  int code;
 
   assert(manifest != NULL);
   assert(manifest->channels != NULL);
-  assert(b + c <= MAX_CHANNELS_NUMBER);
 
   /* return if there is no name service or network sources */
   if(manifest->name_server == NULL) return;
@@ -187,20 +290,42 @@ void NameServiceCtor(struct Manifest *manifest, uint32_t b, uint32_t c)
   ZLOGFAIL(manifest->name_server->protocol != ProtoUDP,
       EFAULT, "name server only support udp protocol");
   parcel = ParcelCtor(manifest, &psize, b, c);
+  server = manifest->name_server;
+  sources = b + c;
+  deadline = time(NULL) + manifest->timeout;
+
+  /* start the exchange. signals are only handled by the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  code = pthread_create(&exchange, NULL, PollServer, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  ZLOGFAIL(code != 0, code, "cannot start name service");
+  started = 1;
+}
+
+void NameServiceDtor(struct Manifest *manifest)
+{
+  uint32_t control_nsources;
 
-  /* exchange parcels with name server */
-  control_psize = PollServer(manifest->name_server, parcel, psize);
-  ZLOGFAIL(control_psize != psize, EFAULT,
+  assert(manifest != NULL);
+
+  /* return if the name service was not asked */
+  if(!started) return;
+  pthread_join(exchange, NULL);
+  started = 0;
+
+  ZLOGIF(retries && received > 0 && !fallback,
+      "name service polled with %d retries", retries);
+  ZLOGS(LOG_DEBUG, "name service %s", fallback ? "fell back to tcp" : "used udp");
+  ZLOGFAIL(received == -1, error, "name service failed");
+  ZLOGFAIL(received != psize, EFAULT,
       "received parcel size %u is not equal to sent one %u",
-      control_psize, psize);
+      received, psize);
 
   /* decode received parcel to channels */
   control_nsources = ParcelDtor(manifest, parcel);
-  ZLOGFAIL(control_nsources != b + c, EFAULT,
+  parcel = NULL;
+  ZLOGFAIL(control_nsources != sources, EFAULT,
       "received parcel records %u is not equal to sent ones %u",
-      control_nsources, b + c);
-}
-
-void NameServiceDtor()
-{
+      control_nsources, sources);
 }
@@ -21,14 +21,15 @@
 /*
  * TODO(d'b): find the neat solution to calculate (10915)
  * ((PARCEL_SIZE - sizeof(struct NSParcel)) / sizeof(struct NSRecord) + 1)
+ * the bigger parcels (channels with many sources) are sent over tcp
  */
 #define MAX_CHANNELS_NUMBER 10915
 #define MIN_CHANNELS_NUMBER 3
 
-/* initialize name service and update channels information */
+/* start the name service exchange in the background */
 void NameServiceCtor(struct Manifest *manifest, uint32_t b, uint32_t c);
 
-/* close name service */
-void NameServiceDtor();
+/* wait for the name service and update channels information */
+void NameServiceDtor(struct Manifest *manifest);
 
 #endif
@@ -14,12 +14,225 @@
  * limitations under the License.
  */
 
-#ifdef zmq
-#include "prefetch_zmq.c"
-#else
-#ifdef udt
-#include "prefetch_udt.c"
-#else
-#error "only supported choices are zmq and udt"
+#include <assert.h>
+#include "src/channels/prefetch.h"
+
+/* TODO(d'b): find more neat solution than put it twice */
+#define XARRAY(a) static char *ARRAY_##a[] = {a};
+#define X(a) #a,
+  XARRAY(PROTOCOLS)
+#undef X
+
+#define TRANSPORT(channel, n) transports[CH_PROTO(channel, n)]
+
+/* compiled in transports. the 1st one serving the protocol wins */
+static const struct Transport *registry[] = {
+#ifdef TRANSPORT_zmq
+  &kZmqTransport,
 #endif
+#ifdef TRANSPORT_udt
+  &kUdtTransport,
 #endif
+#ifdef TRANSPORT_tcp
+  &kTcpTransport,
+#endif
+#ifdef TRANSPORT_shm
+  &kShmTransport,
+#endif
+  NULL
+};
+
+/* transport for each network protocol (or NULL) */
+static const struct Transport *transports[ProtoRegular];
+
+/* transports used by the session (NULL terminated) */
+static const struct Transport *active[ARRAY_SIZE(registry)];
+
+/* map network protocols to transports */
+static void RegisterTransports()
+{
+  int i;
+  int p;
+
+  for(i = 0; registry[i] != NULL; ++i)
+    for(p = 0; p < ProtoRegular; ++p)
+      if(transports[p] == NULL && (registry[i]->protocols & (1 << p)))
+        transports[p] = registry[i];
+}
+
+/* add the transport to the session transports */
+static void Activate(const struct Transport *t)
+{
+  int i;
+
+  for(i = 0; active[i] != NULL; ++i)
+    if(active[i] == t) return;
+  active[i] = t;
+}
+
+/* return transport of the channel network sources or NULL */
+static const struct Transport *ChannelTransport(const struct ChannelDesc *channel)
+{
+  int n;
+
+  for(n = 0; n < channel->source->len; ++n)
+    if(IS_NETWORK(CH_CONN(channel, n)))
+      return TRANSPORT(channel, n);
+  return NULL;
+}
+
+void NetCtor(const struct Manifest *manifest)
+{
+  int i;
+  int n;
+
+  assert(manifest != NULL);
+  RegisterTransports();
+
+  /* check all network sources and find the used transports */
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+    const struct Transport *t = ChannelTransport(channel);
+
+    for(n = 0; n < channel->source->len; ++n)
+    {
+      if(IS_FILE(CH_CONN(channel, n))) continue;
+
+      ZLOGFAIL(TRANSPORT(channel, n) == NULL, EFAULT,
+          "%s;%d: no transport for %s", channel->alias, n,
+          XSTR(PROTOCOLS, CH_PROTO(channel, n)));
+      ZLOGFAIL(TRANSPORT(channel, n) != t, EFAULT,
+          "%s: sources have different transports", channel->alias);
+    }
+
+    if(t != NULL) Activate(t);
+  }
+
+  /* construct the used transports */
+  for(i = 0; active[i] != NULL; ++i)
+  {
+    ZLOGS(LOG_DEBUG, "NetCtor: %s transport", active[i]->name);
+    active[i]->Ctor(manifest);
+  }
+}
+
+void NetDtor(struct Manifest *manifest)
+{
+  int i;
+
+  for(i = 0; active[i] != NULL; ++i)
+  {
+    ZLOGS(LOG_DEBUG, "NetDtor: %s transport", active[i]->name);
+    active[i]->Dtor(manifest);
+    active[i] = NULL;
+  }
+}
+
+void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
+{
+  ZLOGFAIL(channel->options[OptMode] == ModeMerge
+      && TRANSPORT(channel, n)->Poll == NULL, EFAULT, "%s: %s transport "
+      "cannot merge", channel->alias, TRANSPORT(channel, n)->name);
+  TRANSPORT(channel, n)->ChannelCtor(channel, n);
+}
+
+void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
+{
+  TRANSPORT(channel, n)->ChannelDtor(channel, n);
+}
+
+void PrefetchAccept(struct ChannelDesc *channel)
+{
+  int n;
+
+  for(n = 0; n < channel->source->len; ++n)
+    if(IS_NETWORK(CH_CONN(channel, n)) && TRANSPORT(channel, n)->Accept != NULL)
+      TRANSPORT(channel, n)->Accept(channel, n);
+}
+
+char *MessageData(struct ChannelDesc *channel)
+{
+  return ChannelTransport(channel)->MessageData(channel);
+}
+
+void FreeMessage(struct ChannelDesc *channel)
+{
+  const struct Transport *t = ChannelTransport(channel);
+
+  /* channel has no network sources */
+  if(t == NULL) return;
+  t->FreeMessage(channel);
+}
+
+void FetchMessage(struct ChannelDesc *channel, int n, int size)
+{
+  TRANSPORT(channel, n)->FetchMessage(channel, n, size);
+}
+
+int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
+{
+  return TRANSPORT(channel, n)->SendData(channel, n, buf, count);
+}
+
+int32_t BroadcastData(struct ChannelDesc *channel, const char *buf, int32_t count)
+{
+  const struct Transport *t = ChannelTransport(channel);
+  int32_t result = count;
+  int n;
+
+  if(t->Broadcast != NULL)
+    return t->Broadcast(channel, buf, count);
+
+  /* the transport cannot share the data, send it to each source */
+  for(n = 0; n < channel->source->len && result >= 0; ++n)
+    result = t->SendData(channel, n, buf, count);
+  return result;
+}
+
+int PollSources(struct ChannelDesc *channel, const uint8_t *open, int start)
+{
+  return ChannelTransport(channel)->Poll(channel, open, start);
+}
+
+void SyncSource(struct ChannelDesc *channel, int n)
+{
+  if(!CH_SEQ_READABLE(channel)) return;
+
+  ZLOGS(LOG_INSANE, "%s;%d before skip pos = %ld, getpos = %ld",
+      channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
+
+  /* if source is a pipe read (*->getpos - *->pos) bytes */
+  if(CH_PROTO(channel, n) == ProtoFIFO || CH_PROTO(channel, n) == ProtoCharacter)
+  {
+    int result;
+    while(CH_CONN(channel, n)->pos < channel->getpos)
+    {
+      char buf[BUFFER_SIZE];
+      result = fread(buf, 1, channel->getpos - CH_CONN(channel, n)->pos,
+          CH_HANDLE(channel, n));
+      ZLOGFAIL(result < 0, EIO, "%s;%d: %s", channel->alias, n, strerror(errno));
+      CH_CONN(channel, n)->pos += result;
+    }
+  }
+
+  /* if source is a network get over (*->getpos - *->pos) bytes */
+  else if(IS_NETWORK(CH_CONN(channel, n)))
+  {
+    while(CH_CONN(channel, n)->pos < channel->getpos && !channel->eof)
+    {
+      FetchMessage(channel, n,
+          MIN(channel->getpos - CH_CONN(channel, n)->pos, BUFFER_SIZE));
+      CH_CONN(channel, n)->pos += channel->bufend;
+    }
+  }
+
+  /* no need to sync with regular files, just set (*->getpos to *->pos) */
+  else
+    CH_CONN(channel, n)->pos = channel->getpos;
+
+  ZLOGS(LOG_INSANE, "%s;%d skipped pos = %ld, getpos = %ld",
+      channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
+  ZLOGFAIL(CH_CONN(channel, n)->pos != channel->getpos,
+      EPIPE, "%s;%d is out of sync", channel->alias, n);
+}
@@ -22,7 +22,58 @@
 #include "src/channels/channel.h"
 #include "src/main/manifest.h"
 
-/* prepare network context */
+/* protocols mask bit */
+#define PROTO_BIT(a) (1 << Proto ## a)
+
+/*
+ * network transport (backend). every compiled in transport is registered
+ * upon NetCtor() and serves the channel sources with the protocols from
+ * its mask. all network sources of the channel must use the same transport
+ */
+struct Transport {
+  char *name;
+  uint32_t protocols; /* mask of served protocols */
+
+  /* prepare and release the transport context */
+  void (*Ctor)(const struct Manifest *manifest);
+  void (*Dtor)(struct Manifest *manifest);
+
+  /* construct (connect/bind) and finalize the channel source */
+  void (*ChannelCtor)(struct ChannelDesc *channel, int n);
+  void (*ChannelDtor)(struct ChannelDesc *channel, int n);
+
+  /* accept the bound source after all channels mounted. can be NULL */
+  void (*Accept)(struct ChannelDesc *channel, int n);
+
+  /* channel message data and its deallocation */
+  char *(*MessageData)(struct ChannelDesc *channel);
+  void (*FreeMessage)(struct ChannelDesc *channel);
+
+  /* receive a new message. "size" is only used by stream transports (udt) */
+  void (*FetchMessage)(struct ChannelDesc *channel, int n, int size);
+
+  /* send the data. return number of sent bytes or negative error code */
+  int32_t (*SendData)(struct ChannelDesc *channel, int n,
+      const char *buf, int32_t count);
+
+  /* send the data to all sources sharing the message buffers. can be NULL */
+  int32_t (*Broadcast)(struct ChannelDesc *channel,
+      const char *buf, int32_t count);
+
+  /*
+   * wait until one of the "open" sources has a message and return its
+   * index, the sources are checked from "start". NULL if cannot merge
+   */
+  int (*Poll)(struct ChannelDesc *channel, const uint8_t *open, int start);
+};
+
+/* transports (see prefetch_*.c). only built ones can be used */
+extern struct Transport const kZmqTransport;
+extern struct Transport const kUdtTransport;
+extern struct Transport const kTcpTransport;
+extern struct Transport const kShmTransport;
+
+/* register transports and prepare the ones used by manifest */
 void NetCtor(const struct Manifest *manifest);
 
 /* deallocate network context */
@@ -37,11 +88,14 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n);
  */
 void PrefetchChannelDtor(struct ChannelDesc *channel, int n);
 
+/* accept the channel bound sources (if transport needs it) */
+void PrefetchAccept(struct ChannelDesc *channel);
+
 /* return already available data of the channel */
 char *MessageData(struct ChannelDesc *channel);
 
-/* receive a new message and update channel with it */
-void FetchMessage(struct ChannelDesc *channel, int n);
+/* receive a new message (up to "size" bytes) and update channel with it */
+void FetchMessage(struct ChannelDesc *channel, int n, int size);
 
 /*
  * skip obsolete messages/bytes until the source will be in sync with
@@ -58,4 +112,13 @@ void FreeMessage(struct ChannelDesc *channel);
  */
 int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count);
 
+/*
+ * send the data to all network sources of the channel
+ * return number of sent bytes or negative error code
+ */
+int32_t BroadcastData(struct ChannelDesc *channel, const char *buf, int32_t count);
+
+/* wait for a message on any "open" source and return the source index */
+int PollSources(struct ChannelDesc *channel, const uint8_t *open, int start);
+
 #endif /* PREFETCH_H_ */
@@ -0,0 +1,656 @@
+/*
+ * intra host network channels: single producer / single consumer ring
+ * in the memfd shared memory. the peers meet on the abstract unix socket
+ * named after the channel port, the write only side creates the ring and
+ * passes its descriptor through the socket
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "src/channels/prefetch.h"
+#include "src/main/accounting.h"
+#include "src/main/report.h"
+
+#define SHM_RING_SIZE 0x400000 /* ring size if not specified */
+#define SHM_NAME "zerovm.shm.%u" /* rendezvous socket (abstract) name */
+#define MSG_SIZE_LIMIT 0x10000000
+#define PAUSE_LIMIT 100 /* the biggest pause between connect attempts (ms) */
+#define WAIT_TIMEOUT 100 /* check the peer is alive after that (ms) */
+#define POLL_PAUSE 1 /* merged channel: check the other rings after that (ms) */
+#define RECORD_HEADER 8 /* message size and alignment */
+#define WRAP 0xffffffff /* "go to the ring beginning" record */
+#define ALIGN(a) (((a) + RECORD_HEADER - 1) & ~(uint64_t)(RECORD_HEADER - 1))
+
+/* old headers */
+#ifndef SYS_memfd_create
+#define SYS_memfd_create 319
+#endif
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 2
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 1
+#define F_SEAL_SHRINK 2
+#define F_SEAL_GROW 4
+#endif
+
+#define FD(channel, n) GPOINTER_TO_INT(CH_HANDLE(channel, n))
+#define PEER(channel, n) ((struct Shm*)CH_BACKUP(channel, n))
+#define RING_DATA(r) ((char*)(r) + sizeof(struct Ring))
+
+/*
+ * ring header at the beginning of the shared memory. the producer only
+ * changes "head", the consumer only changes "tail". futex words are
+ * bumped after each change to wake the sleeping peer. the peer can write
+ * the header at any time, so each side keeps the size and its own index
+ * privately and only publishes them here
+ */
+struct Ring {
+  volatile uint64_t head; /* bytes published by the producer */
+  volatile uint32_t data; /* futex: new data published */
+  volatile uint32_t data_waiters;
+  char pad1[48]; /* keep producer and consumer fields apart */
+  volatile uint64_t tail; /* bytes released by the consumer */
+  volatile uint32_t space; /* futex: space released */
+  volatile uint32_t space_waiters;
+  volatile uint32_t cancel; /* the consumer does not need more data */
+  char pad2[44];
+  uint64_t size; /* data size (power of 2) */
+  char pad3[56];
+};
+
+/* source internals (stored in the connection "backup") */
+struct Shm {
+  int listener; /* RO: listening socket until the peer accepted or -1 */
+  struct Ring *ring;
+  uint64_t mapped; /* shared memory size */
+  uint64_t size; /* validated ring data size */
+  uint64_t index; /* own ring index: head (WO) or tail (RO) */
+  uint64_t taken; /* RO: ring bytes of the current message */
+};
+
+/* received message (channel->msg). points to the ring */
+struct Message {
+  char *data;
+};
+
+/* fill the socket address for the given port. return the address size */
+static socklen_t MakeAddress(struct sockaddr_un *addr, uint16_t port)
+{
+  memset(addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  g_snprintf(addr->sun_path + 1, sizeof addr->sun_path - 1, SHM_NAME, port);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr->sun_path + 1);
+}
+
+/* return 1 if the peer runs under the same user */
+static int Trusted(int fd)
+{
+  struct ucred cred;
+  socklen_t size = sizeof cred;
+
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) < 0) return 0;
+  return cred.uid == geteuid();
+}
+
+/* return 1 if the peer closed the socket */
+static int HungUp(int fd)
+{
+  struct pollfd p = {fd, POLLRDHUP, 0};
+
+  if(poll(&p, 1, 0) < 0) return 0;
+  return (p.revents & (POLLHUP | POLLRDHUP | POLLERR)) != 0;
+}
+
+/* bump the futex and wake the peer if it sleeps */
+static void Wake(volatile uint32_t *futex, volatile uint32_t *waiters)
+{
+  __sync_fetch_and_add(futex, 1);
+  if(*waiters > 0)
+    syscall(SYS_futex, futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* bytes available to the producer (free space) or to the consumer (data) */
+static uint64_t Available(struct Shm *s, int consumer)
+{
+  return consumer ? s->ring->head - s->index
+      : s->size - (s->index - s->ring->tail);
+}
+
+/*
+ * wait until "amount" bytes are available. fail if the peer has gone.
+ * the producer returns without space if the consumer cancelled the ring
+ */
+static void Wait(struct ChannelDesc *channel, int n, int consumer, uint64_t amount)
+{
+  struct Shm *s = PEER(channel, n);
+  struct Ring *r = s->ring;
+  volatile uint32_t *futex = consumer ? &r->data : &r->space;
+  volatile uint32_t *waiters = consumer ? &r->data_waiters : &r->space_waiters;
+  struct timespec timeout = {0, WAIT_TIMEOUT * 1000000};
+
+  while(Available(s, consumer) < amount)
+  {
+    uint32_t value;
+
+    if(!consumer && r->cancel) return;
+
+    __sync_fetch_and_add(waiters, 1);
+    value = *futex;
+    if(Available(s, consumer) < amount)
+      syscall(SYS_futex, futex, FUTEX_WAIT, value, &timeout, NULL, 0);
+    __sync_fetch_and_sub(waiters, 1);
+
+    /* the consumer may cancel the ring and hang up right away */
+    if(!consumer && r->cancel) return;
+    ZLOGFAIL(Available(s, consumer) < amount && HungUp(FD(channel, n)),
+        EPIPE, "%s;%d lost the peer", channel->alias, n);
+  }
+
+  /* the data (or space) is visible after the index */
+  __sync_synchronize();
+}
+
+/* publish "size" written bytes to the consumer */
+static void Publish(struct Shm *s, uint64_t size)
+{
+  __sync_synchronize();
+  s->index += size;
+  s->ring->head = s->index;
+  Wake(&s->ring->data, &s->ring->data_waiters);
+}
+
+/* give the current message space back to the producer */
+static void Release(struct ChannelDesc *channel, int n)
+{
+  struct Shm *s = PEER(channel, n);
+
+  if(s->taken == 0) return;
+  __sync_synchronize();
+  s->index += s->taken;
+  s->ring->tail = s->index;
+  s->taken = 0;
+  Wake(&s->ring->space, &s->ring->space_waiters);
+}
+
+/* map the ring from the memfd descriptor */
+static void MapRing(struct ChannelDesc *channel, int n, int fd, uint64_t size)
+{
+  struct Shm *s = PEER(channel, n);
+
+  s->ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ZLOGFAIL(s->ring == MAP_FAILED, EFAULT, "cannot map %s;%d ring: %s",
+      channel->alias, n, strerror(errno));
+  s->mapped = size;
+}
+
+/* bind the RO source to the 1st available (or given) port */
+static void Bind(struct ChannelDesc *channel, int n)
+{
+  int i;
+  int fd;
+  int result;
+  uint16_t port = CH_PORT(channel, n);
+  struct sockaddr_un addr;
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ZLOGFAIL(fd < 0, EFAULT, "cannot get socket for %s;%d: %s",
+      channel->alias, n, strerror(errno));
+
+  /* no port given: probe them starting from the random one */
+  if(port != 0)
+    result = bind(fd, (struct sockaddr*)&addr, MakeAddress(&addr, port));
+  else
+  {
+    port = g_random_int_range(1, USHRT_MAX);
+    for(i = 0; i < USHRT_MAX; ++i, port = port % (USHRT_MAX - 1) + 1)
+    {
+      result = bind(fd, (struct sockaddr*)&addr, MakeAddress(&addr, port));
+      if(result == 0 || errno != EADDRINUSE) break;
+    }
+  }
+  ZLOGFAIL(result < 0, EFAULT, "cannot bind %s;%d: %s",
+      channel->alias, n, strerror(errno));
+  ZLOGFAIL(listen(fd, 1) < 0, EFAULT, "cannot listen %s;%d: %s",
+      channel->alias, n, strerror(errno));
+
+  CH_PORT(channel, n) = port;
+  PEER(channel, n)->listener = fd;
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(fd);
+  ZLOGS(LOG_DEBUG, "bind(): port = %u", port);
+}
+
+/*
+ * accept the peer of RO source and map its ring if not done yet. the
+ * rendezvous socket is visible to the whole host, so the peers of the
+ * other users are dropped and the ring must be sealed against resizing
+ */
+static void Accept(struct ChannelDesc *channel, int n)
+{
+  int fd;
+  int seals;
+  char dummy;
+  char control[CMSG_SPACE(sizeof fd)];
+  struct iovec iov = {&dummy, sizeof dummy};
+  struct msghdr msg = {0};
+  struct cmsghdr *cm;
+  struct stat st;
+  struct Shm *s = PEER(channel, n);
+
+  if(s->listener < 0) return;
+
+  for(;;)
+  {
+    fd = accept4(s->listener, NULL, NULL, SOCK_CLOEXEC);
+    if(fd < 0)
+    {
+      ZLOGFAIL(errno != EINTR, EFAULT, "cannot accept %s;%d: %s",
+          channel->alias, n, strerror(errno));
+      continue;
+    }
+    if(Trusted(fd)) break;
+    ZLOG(LOG_ERROR, "%s;%d dropped the peer of another user", channel->alias, n);
+    close(fd);
+  }
+  close(s->listener);
+  s->listener = -1;
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(fd);
+
+  /* get the ring descriptor */
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+  while(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) < 0)
+    ZLOGFAIL(errno != EINTR, EPIPE, "%s;%d: %s",
+        channel->alias, n, strerror(errno));
+
+  cm = CMSG_FIRSTHDR(&msg);
+  ZLOGFAIL(cm == NULL || cm->cmsg_type != SCM_RIGHTS, EPIPE,
+      "%s;%d did not get the ring", channel->alias, n);
+  memcpy(&fd, CMSG_DATA(cm), sizeof fd);
+  seals = fcntl(fd, F_GET_SEALS);
+  ZLOGFAIL(seals < 0 || (~seals & (F_SEAL_SHRINK | F_SEAL_SEAL)), EPIPE,
+      "%s;%d got unsealed ring", channel->alias, n);
+  ZLOGFAIL(fstat(fd, &st) < 0 || st.st_size <= sizeof(struct Ring), EPIPE,
+      "%s;%d got invalid ring", channel->alias, n);
+  MapRing(channel, n, fd, st.st_size);
+  close(fd);
+
+  /* the size is read once, only the private copy is used */
+  s->size = s->ring->size;
+  ZLOGFAIL(s->size != st.st_size - sizeof(struct Ring)
+      || s->size < RECORD_HEADER || (s->size & (s->size - 1)) != 0, EPIPE,
+      "%s;%d got invalid ring", channel->alias, n);
+}
+
+/* connect the WO source, create the ring and pass it to the peer */
+static void Connect(struct ChannelDesc *channel, int n)
+{
+  int fd;
+  int memfd;
+  int pause = 1;
+  uint64_t size;
+  struct sockaddr_un addr;
+  socklen_t len = MakeAddress(&addr, CH_PORT(channel, n));
+  char dummy = 0;
+  char control[CMSG_SPACE(sizeof memfd)];
+  struct iovec iov = {&dummy, sizeof dummy};
+  struct msghdr msg = {0};
+  struct cmsghdr *cm;
+
+  /* wait for the peer if it does not listen yet */
+  for(;;)
+  {
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ZLOGFAIL(fd < 0, EFAULT, "cannot get socket for %s;%d: %s",
+        channel->alias, n, strerror(errno));
+
+    if(connect(fd, (struct sockaddr*)&addr, len) == 0) break;
+    ZLOGFAIL(errno != ECONNREFUSED && errno != EINTR, EFAULT,
+        "cannot connect %s;%d: %s", channel->alias, n, strerror(errno));
+
+    close(fd);
+    usleep(pause * 1000);
+    pause = MIN(pause * 2, PAUSE_LIMIT);
+  }
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(fd);
+  ZLOGFAIL(!Trusted(fd), EFAULT, "%s;%d peer belongs to another user",
+      channel->alias, n);
+
+  /* the ring must hold at least 2 the biggest messages */
+  size = channel->options[OptSndBuf] == 0
+      ? SHM_RING_SIZE : channel->options[OptSndBuf];
+  size = MAX(size, 2 * (RECORD_HEADER + ALIGN(channel->options[OptMsgSize])));
+  size = 1LLU << g_bit_storage(size - 1);
+
+  /* create the ring */
+  memfd = syscall(SYS_memfd_create, "zerovm-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  ZLOGFAIL(memfd < 0, EFAULT, "cannot create %s;%d ring: %s",
+      channel->alias, n, strerror(errno));
+  ZLOGFAIL(ftruncate(memfd, sizeof(struct Ring) + size) < 0, EFAULT,
+      "cannot allocate %s;%d ring: %s", channel->alias, n, strerror(errno));
+  ZLOGFAIL(fcntl(memfd, F_ADD_SEALS,
+      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0, EFAULT,
+      "cannot seal %s;%d ring: %s", channel->alias, n, strerror(errno));
+  MapRing(channel, n, memfd, sizeof(struct Ring) + size);
+  PEER(channel, n)->size = size;
+  PEER(channel, n)->ring->size = size;
+
+  /* pass it to the peer */
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+  cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof memfd);
+  memcpy(CMSG_DATA(cm), &memfd, sizeof memfd);
+  ZLOGFAIL(sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof dummy, EFAULT,
+      "cannot pass %s;%d ring: %s", channel->alias, n, strerror(errno));
+  close(memfd);
+  ZLOGS(LOG_DEBUG, "connected %s;%d (ring %lu)", channel->alias, n, size);
+}
+
+static void ShmNetCtor(const struct Manifest *manifest)
+{
+  ZLOGS(LOG_DEBUG, "shared memory network");
+}
+
+static void ShmNetDtor(struct Manifest *manifest)
+{
+}
+
+static char *ShmMessageData(struct ChannelDesc *channel)
+{
+  return ((struct Message*)channel->msg)->data;
+}
+
+static void ShmFreeMessage(struct ChannelDesc *channel)
+{
+  g_free(channel->msg);
+  channel->msg = NULL;
+}
+
+/* get the next message. the message data stays in the ring until the next one */
+static void GetMessage(struct ChannelDesc *channel, int n)
+{
+  uint32_t size;
+  uint64_t pos;
+  struct Shm *s = PEER(channel, n);
+  struct Ring *r;
+
+  ZLOGS(LOG_INSANE, "GetMessage of %s;%d", channel->alias, n);
+  Accept(channel, n);
+  Release(channel, n);
+  r = s->ring;
+
+  /* find the message header */
+  for(;;)
+  {
+    Wait(channel, n, 1, RECORD_HEADER);
+    pos = s->index & (s->size - 1);
+    size = *(volatile uint32_t*)(RING_DATA(r) + pos);
+    if(size != WRAP) break;
+
+    s->taken = s->size - pos;
+    Release(channel, n);
+  }
+
+  ZLOGFAIL(size > s->size - pos - RECORD_HEADER, EPIPE,
+      "%s;%d got invalid message size %u", channel->alias, n, size);
+  s->taken = RECORD_HEADER + ALIGN(size);
+  ((struct Message*)channel->msg)->data = RING_DATA(r) + pos + RECORD_HEADER;
+  channel->bufend = size;
+  channel->bufpos = 0;
+}
+
+static void ShmFetchMessage(struct ChannelDesc *channel, int n, int size)
+{
+  ZLOGS(LOG_INSANE, "FetchMessage of %s;%d", channel->alias, n);
+
+  /* get message */
+  if(channel->eof) return;
+  GetMessage(channel, n);
+
+  /* if EOF detected get the 2nd part */
+  if(channel->bufend > 0) return;
+  GetMessage(channel, n);
+  channel->eof = 1;
+
+  /* check EOF digest size */
+  if(channel->bufend > 0)
+    ZLOGFAIL(channel->bufend != TAG_DIGEST_SIZE, EFAULT,
+        "invalid EOF size = %d", channel->bufend);
+}
+
+/* return 1 if the socket has data (or connection) to read */
+static int Readable(int fd)
+{
+  struct pollfd p = {fd, POLLIN, 0};
+  return poll(&p, 1, 0) > 0;
+}
+
+/*
+ * there is no way to wait for several rings, so the function sleeps on
+ * the 1st ring without data and checks the others after a short pause
+ */
+static int ShmPoll(struct ChannelDesc *channel, const uint8_t *open, int start)
+{
+  int len = channel->source->len;
+  struct timespec timeout = {0, POLL_PAUSE * 1000000};
+  int i;
+
+  for(;;)
+  {
+    struct Shm *sleeper = NULL;
+    uint32_t value;
+
+    for(i = 0; i < len; ++i)
+    {
+      int n = (start + i) % len;
+      struct Shm *s = PEER(channel, n);
+
+      if(!open[n]) continue;
+
+      /* accept the connecting peer */
+      if(s->listener >= 0)
+      {
+        if(!Readable(s->listener)) continue;
+        Accept(channel, n);
+      }
+
+      if(Available(s, 1) > s->taken) return n;
+      ZLOGFAIL(HungUp(FD(channel, n)) && Available(s, 1) <= s->taken,
+          EPIPE, "%s;%d lost the peer", channel->alias, n);
+      if(sleeper == NULL) sleeper = s;
+    }
+
+    /* no rings yet: wait for the peers connection */
+    if(sleeper == NULL)
+    {
+      nanosleep(&timeout, NULL);
+      continue;
+    }
+
+    __sync_fetch_and_add(&sleeper->ring->data_waiters, 1);
+    value = sleeper->ring->data;
+    if(Available(sleeper, 1) <= sleeper->taken)
+      syscall(SYS_futex, &sleeper->ring->data, FUTEX_WAIT, value, &timeout, NULL, 0);
+    __sync_fetch_and_sub(&sleeper->ring->data_waiters, 1);
+  }
+}
+
+/* put the message to the ring (the ring must fit it) */
+static void SendMessage(struct ChannelDesc *channel, int n,
+    const char *buf, int32_t size)
+{
+  struct Shm *s = PEER(channel, n);
+  struct Ring *r = s->ring;
+  uint64_t need = RECORD_HEADER + ALIGN(size);
+  uint64_t pos = s->index & (s->size - 1);
+
+  ZLOGS(LOG_INSANE, "SendMessage to %s;%d", channel->alias, n);
+
+  /* nobody reads the ring */
+  if(r->cancel) return;
+
+  /* the message cannot be split. skip the ring tail */
+  if(s->size - pos < need)
+  {
+    Wait(channel, n, 0, s->size - pos);
+    if(r->cancel) return;
+    *(uint32_t*)(RING_DATA(r) + pos) = WRAP;
+    Publish(s, s->size - pos);
+    pos = 0;
+  }
+
+  Wait(channel, n, 0, need);
+  if(r->cancel) return;
+  *(uint32_t*)(RING_DATA(r) + pos) = size;
+  memcpy(RING_DATA(r) + pos + RECORD_HEADER, buf, size);
+  Publish(s, need);
+}
+
+static int32_t ShmSendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
+{
+  int32_t writerest;
+  int32_t msgsize;
+
+  assert(channel != NULL);
+  assert(buf != NULL);
+
+  /* send a buffer through the multiple messages */
+  ZLOGS(LOG_INSANE, "send(): channel %s;%d, buffer=0x%lx, size=%d",
+      channel->alias, n, (intptr_t)buf, count);
+  msgsize = channel->options[OptMsgSize];
+  for(writerest = count; writerest > 0; writerest -= msgsize)
+  {
+    int32_t towrite = MIN(writerest, msgsize);
+
+    /* the reader does not need the data, pretend it is sent */
+    if(PEER(channel, n)->ring->cancel) break;
+    SendMessage(channel, n, buf, towrite);
+    buf += towrite;
+  }
+
+  return count;
+}
+
+static void ShmChannelCtor(struct ChannelDesc *channel, int n)
+{
+  assert(channel != NULL);
+  assert(n < channel->source->len);
+
+  ZLOGS(LOG_DEBUG, "prefetch %s;%d", channel->alias, n);
+  ZLOGFAIL((uint32_t)CH_RW_TYPE(channel) - 1 > 1, EFAULT, "invalid i/o type");
+  ZLOGFAIL(channel->options[OptMsgSize] == 0
+      || channel->options[OptMsgSize] > MSG_SIZE_LIMIT, EFAULT,
+      "invalid message size for %s", channel->alias);
+  CH_FLAGS(channel, n) |= (CH_RW_TYPE(channel) - 1) << 1;
+
+  CH_BACKUP(channel, n) = g_malloc0(sizeof(struct Shm));
+  PEER(channel, n)->listener = -1;
+
+  /* allocate one message per channel */
+  if(channel->msg == NULL && IS_RO(channel))
+    channel->msg = g_malloc0(sizeof(struct Message));
+
+  /* bind or connect the channel */
+  IS_RO(channel) ? Bind(channel, n) : Connect(channel, n);
+}
+
+static void ShmChannelDtor(struct ChannelDesc *channel, int n)
+{
+  char buf[TAG_DIGEST_SIZE + 1] = "disabled", *digest = buf;
+  int dsize = 0;
+  struct Shm *s = PEER(channel, n);
+
+  /* skip source closing if session is broken */
+  if(GetExitCode() != 0) return;
+
+  assert(channel != NULL);
+  assert(n < channel->source->len);
+  ZLOGS(LOG_DEBUG, "closing %s;%d", channel->alias, n);
+
+  /* close WO source (send EOF and digest) */
+  if(IS_WO(channel))
+  {
+    channel->eof = 1;
+    SendMessage(channel, n, digest, 0);
+    if(channel->tag != NULL)
+    {
+      TagDigest(channel->tag, digest);
+      dsize = TAG_DIGEST_SIZE;
+    }
+    SendMessage(channel, n, digest, dsize);
+    CountPut(CH_CONN(channel, n), 0);
+  }
+  /* close RO source, "fast forward" to EOF if needed */
+  else
+  {
+    if(CH_CONN(channel, n)->pos < channel->getpos)
+      channel->eof = 0;
+
+    /* stop the writer. the data left in the ring is not needed */
+    if(channel->eof == 0)
+    {
+      Accept(channel, n);
+      s->ring->cancel = 1;
+      Wake(&s->ring->space, &s->ring->space_waiters);
+      channel->eof = 1;
+      ZLOGS(LOG_DEBUG, "%s;%d is cancelled", channel->alias, n);
+    }
+    Release(channel, n);
+  }
+
+  /* close source. the ring lives until both peers unmap it */
+  if(s->ring != NULL) munmap(s->ring, s->mapped);
+  close(FD(channel, n));
+  CH_HANDLE(channel, n) = NULL;
+  g_free(s);
+  CH_BACKUP(channel, n) = NULL;
+}
+
+struct Transport const kShmTransport = {
+  "shm",
+  PROTO_BIT(SHM) | PROTO_BIT(IPC),
+  ShmNetCtor,
+  ShmNetDtor,
+  ShmChannelCtor,
+  ShmChannelDtor,
+  NULL,
+  ShmMessageData,
+  ShmFreeMessage,
+  ShmFetchMessage,
+  ShmSendData,
+  NULL,
+  ShmPoll,
+};
@@ -0,0 +1,551 @@
+/*
+ * native tcp network channels: length prefixed messages over the
+ * non-blocking sockets without 3rd party libraries
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <arpa/inet.h> /* convert ip <-> int */
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+#include "src/channels/prefetch.h"
+#include "src/main/accounting.h"
+#include "src/main/report.h"
+
+#define TCP_BUFFER_SIZE 0x400000 /* socket buffers if not specified */
+#define ZEROCOPY_LIMIT 0x4000 /* smaller messages are copied by kernel */
+#define MSG_SIZE_LIMIT 0x10000000
+#define PAUSE_LIMIT 100 /* the biggest pause between connect attempts (ms) */
+#define CANCEL 'C' /* RO: the reader does not need more data */
+
+/* old headers */
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define FD(channel, n) GPOINTER_TO_INT(CH_HANDLE(channel, n))
+#define PEER(channel, n) ((struct Peer*)CH_BACKUP(channel, n))
+
+/* source internals (stored in the connection "backup") */
+struct Peer {
+  int listener; /* RO: listening socket until the peer accepted or -1 */
+  int zerocopy; /* WO: MSG_ZEROCOPY available */
+  uint32_t sent; /* WO: zero copy sends */
+  uint32_t done; /* WO: completed zero copy sends */
+  int cancelled; /* WO: the reader asked to stop sending */
+};
+
+/* received message (channel->msg) */
+struct Message {
+  char *data;
+  int32_t capacity;
+};
+
+/* wait until the socket is ready for the given events (or error) */
+static void Wait(int fd, short events)
+{
+  struct pollfd p = {fd, events, 0};
+
+  while(poll(&p, 1, -1) < 0)
+    ZLOGFAIL(errno != EINTR, EIO, "poll: %s", strerror(errno));
+}
+
+/* receive exactly "size" bytes. return 0 if the peer has gone */
+static int Recv(int fd, char *buf, int32_t size)
+{
+  while(size > 0)
+  {
+    ssize_t i = recv(fd, buf, size, 0);
+
+    if(i == 0) return 0;
+    if(i > 0)
+    {
+      buf += i;
+      size -= i;
+    }
+    else if(errno == EAGAIN || errno == EWOULDBLOCK)
+      Wait(fd, POLLIN);
+    else
+      ZLOGFAIL(errno != EINTR, EIO, "recv: %s", strerror(errno));
+  }
+  return 1;
+}
+
+/* take the reader cancellation (or the reader close) if any */
+static void TakeCancel(struct ChannelDesc *channel, int n)
+{
+  char c;
+
+  if(recv(FD(channel, n), &c, sizeof c, MSG_DONTWAIT) >= 0)
+  {
+    PEER(channel, n)->cancelled = 1;
+    ZLOGS(LOG_DEBUG, "%s;%d is cancelled", channel->alias, n);
+  }
+}
+
+/* wait until the WO socket is writable watching for the cancellation */
+static void WaitWritable(struct ChannelDesc *channel, int n)
+{
+  struct pollfd p = {FD(channel, n), POLLOUT, 0};
+
+  if(!PEER(channel, n)->cancelled) p.events |= POLLIN;
+  while(poll(&p, 1, -1) < 0)
+    ZLOGFAIL(errno != EINTR, EIO, "poll: %s", strerror(errno));
+  if(p.revents & POLLIN) TakeCancel(channel, n);
+}
+
+/* send exactly "size" bytes */
+static void Send(struct ChannelDesc *channel, int n,
+    const char *buf, int32_t size, int flags)
+{
+  while(size > 0)
+  {
+    ssize_t i = send(FD(channel, n), buf, size, flags | MSG_NOSIGNAL);
+
+    if(i >= 0)
+    {
+      if(flags & MSG_ZEROCOPY) ++PEER(channel, n)->sent;
+      buf += i;
+      size -= i;
+    }
+    else if(errno == EAGAIN || errno == EWOULDBLOCK)
+      WaitWritable(channel, n);
+    else if(errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+      flags &= ~MSG_ZEROCOPY; /* socket option memory exhausted */
+    else
+      ZLOGFAIL(errno != EINTR, EIO, "%s;%d send: %s",
+          channel->alias, n, strerror(errno));
+  }
+}
+
+/*
+ * wait until kernel releases all zero copy data. after that the user
+ * can change the buffer
+ */
+static void WaitCompletion(struct ChannelDesc *channel, int n)
+{
+  struct Peer *p = PEER(channel, n);
+
+  while(p->done != p->sent)
+  {
+    char control[BIG_ENOUGH_STRING];
+    struct msghdr msg = {0};
+    struct cmsghdr *cm;
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if(recvmsg(FD(channel, n), &msg, MSG_ERRQUEUE) < 0)
+    {
+      ZLOGFAIL(errno != EAGAIN && errno != EINTR, EIO, "%s;%d completion: %s",
+          channel->alias, n, strerror(errno));
+      Wait(FD(channel, n), 0);
+      continue;
+    }
+
+    for(cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+    {
+      struct sock_extended_err *err = (struct sock_extended_err*)CMSG_DATA(cm);
+
+      if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+      p->done += err->ee_data - err->ee_info + 1;
+    }
+  }
+}
+
+/* set socket buffer size. 0 means default (big) size */
+static void SetBuffer(int fd, int option, int size)
+{
+  size = size == 0 ? TCP_BUFFER_SIZE : size;
+  ZLOGIF(setsockopt(fd, SOL_SOCKET, option, &size, sizeof size) < 0,
+      "cannot set socket buffer: %s", strerror(errno));
+}
+
+/* bind the RO source. the connection will be accepted on the 1st use */
+static void Bind(struct ChannelDesc *channel, int n)
+{
+  int fd;
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof addr;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  ZLOGFAIL(fd < 0, EFAULT, "cannot get socket for %s;%d: %s",
+      channel->alias, n, strerror(errno));
+  SetBuffer(fd, SO_RCVBUF, channel->options[OptRcvBuf]);
+
+  /* bind to the given or 1st available port */
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = IS_IPHOST(CH_CONN(channel, n))
+      ? CH_HOST(channel, n) : htonl(INADDR_ANY);
+  addr.sin_port = htons(CH_PORT(channel, n));
+  ZLOGFAIL(bind(fd, (struct sockaddr*)&addr, sizeof addr) < 0, EFAULT,
+      "cannot bind %s;%d: %s", channel->alias, n, strerror(errno));
+  ZLOGFAIL(listen(fd, 1) < 0, EFAULT, "cannot listen %s;%d: %s",
+      channel->alias, n, strerror(errno));
+
+  /* extract port to connection structure */
+  ZLOGFAIL(getsockname(fd, (struct sockaddr*)&addr, &size) < 0, EFAULT,
+      "cannot get port %s;%d: %s", channel->alias, n, strerror(errno));
+  CH_PORT(channel, n) = ntohs(addr.sin_port);
+  PEER(channel, n)->listener = fd;
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(fd);
+  ZLOGS(LOG_DEBUG, "bind(): host = %u, port = %u",
+      CH_HOST(channel, n), CH_PORT(channel, n));
+}
+
+/* accept the peer of RO source if not accepted yet */
+static void Accept(struct ChannelDesc *channel, int n)
+{
+  int fd;
+  struct Peer *p = PEER(channel, n);
+
+  if(p->listener < 0) return;
+
+  while((fd = accept4(p->listener, NULL, NULL, SOCK_NONBLOCK)) < 0)
+    ZLOGFAIL(errno != EINTR, EFAULT, "cannot accept %s;%d: %s",
+        channel->alias, n, strerror(errno));
+
+  close(p->listener);
+  p->listener = -1;
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(fd);
+}
+
+/*
+ * return 1 if the connected peer is on this host. loopback completes
+ * zero copy sends only when the reader takes the data
+ */
+static int IsLocal(int fd)
+{
+  struct sockaddr_in local = {0}, peer = {0};
+  socklen_t size = sizeof local;
+
+  if(getsockname(fd, (struct sockaddr*)&local, &size) < 0) return 1;
+  size = sizeof peer;
+  if(getpeername(fd, (struct sockaddr*)&peer, &size) < 0) return 1;
+  return local.sin_addr.s_addr == peer.sin_addr.s_addr
+      || ntohl(peer.sin_addr.s_addr) >> 24 == IN_LOOPBACKNET;
+}
+
+/* connect the WO source. wait for the peer if it does not listen yet */
+static void Connect(struct ChannelDesc *channel, int n)
+{
+  int fd;
+  int on = 1;
+  int pause = 1;
+  struct sockaddr_in addr = {0};
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = CH_HOST(channel, n);
+  addr.sin_port = htons(CH_PORT(channel, n));
+
+  for(;;)
+  {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    ZLOGFAIL(fd < 0, EFAULT, "cannot get socket for %s;%d: %s",
+        channel->alias, n, strerror(errno));
+    SetBuffer(fd, SO_SNDBUF, channel->options[OptSndBuf]);
+
+    if(connect(fd, (struct sockaddr*)&addr, sizeof addr) == 0) break;
+    ZLOGFAIL(errno != ECONNREFUSED && errno != EINTR, EFAULT,
+        "cannot connect %s;%d: %s", channel->alias, n, strerror(errno));
+
+    /* the peer is not ready. try again later */
+    close(fd);
+    usleep(pause * 1000);
+    pause = MIN(pause * 2, PAUSE_LIMIT);
+  }
+
+  /*
+   * framing is done by zerovm, disable nagle. zero copy is optional and
+   * only for the remote peers (the local writer would wait for the reader)
+   */
+  ZLOGIF(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on) < 0,
+      "cannot set nodelay: %s", strerror(errno));
+  PEER(channel, n)->zerocopy = !IsLocal(fd)
+      && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) == 0;
+  ZLOGFAIL(fcntl(fd, F_SETFL, O_NONBLOCK) < 0, EFAULT,
+      "%s;%d: %s", channel->alias, n, strerror(errno));
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(fd);
+  ZLOGS(LOG_DEBUG, "connected %s;%d (zero copy %d)",
+      channel->alias, n, PEER(channel, n)->zerocopy);
+}
+
+static void TcpNetCtor(const struct Manifest *manifest)
+{
+  ZLOGS(LOG_DEBUG, "native tcp network");
+}
+
+static void TcpNetDtor(struct Manifest *manifest)
+{
+}
+
+static char *TcpMessageData(struct ChannelDesc *channel)
+{
+  return ((struct Message*)channel->msg)->data;
+}
+
+static void TcpFreeMessage(struct ChannelDesc *channel)
+{
+  struct Message *m = channel->msg;
+
+  if(m == NULL) return;
+  g_free(m->data);
+  g_free(m);
+  channel->msg = NULL;
+}
+
+/* get the next message. updates channel->msg (and indices) */
+static void GetMessage(struct ChannelDesc *channel, int n)
+{
+  uint32_t size;
+  struct Message *m = channel->msg;
+
+  ZLOGS(LOG_INSANE, "GetMessage of %s;%d", channel->alias, n);
+  Accept(channel, n);
+
+  /* get the message size, then the message */
+  ZLOGFAIL(!Recv(FD(channel, n), (char*)&size, sizeof size), EPIPE,
+      "%s;%d lost the peer", channel->alias, n);
+  size = ntohl(size);
+  ZLOGFAIL(size > MSG_SIZE_LIMIT, EPIPE, "%s;%d got invalid message size %u",
+      channel->alias, n, size);
+
+  if(size > m->capacity)
+  {
+    m->data = g_realloc(m->data, size);
+    m->capacity = size;
+  }
+  ZLOGFAIL(!Recv(FD(channel, n), m->data, size), EPIPE,
+      "%s;%d lost the peer", channel->alias, n);
+
+  channel->bufend = size;
+  channel->bufpos = 0;
+}
+
+static void TcpFetchMessage(struct ChannelDesc *channel, int n, int size)
+{
+  ZLOGS(LOG_INSANE, "FetchMessage of %s;%d", channel->alias, n);
+
+  /* get message */
+  if(channel->eof) return;
+  GetMessage(channel, n);
+
+  /* if EOF detected get the 2nd part */
+  if(channel->bufend > 0) return;
+  GetMessage(channel, n);
+  channel->eof = 1;
+
+  /* check EOF digest size */
+  if(channel->bufend > 0)
+    ZLOGFAIL(channel->bufend != TAG_DIGEST_SIZE, EFAULT,
+        "invalid EOF size = %d", channel->bufend);
+}
+
+static int TcpPoll(struct ChannelDesc *channel, const uint8_t *open, int start)
+{
+  int len = channel->source->len;
+  struct pollfd *p = g_malloc0(len * sizeof *p);
+  int *index = g_malloc(len * sizeof *index);
+  int result = -1;
+  int count = 0;
+  int i;
+
+  /* poll "open" sources in turn beginning from "start" */
+  for(i = 0; i < len; ++i)
+    if(open[(start + i) % len])
+    {
+      index[count] = (start + i) % len;
+      p[count].fd = FD(channel, index[count]);
+      p[count++].events = POLLIN;
+    }
+
+  while(result < 0)
+  {
+    while(poll(p, count, -1) < 0)
+      ZLOGFAIL(errno != EINTR, EIO, "poll: %s", strerror(errno));
+
+    for(i = 0; i < count && result < 0; ++i)
+    {
+      if(p[i].revents == 0) continue;
+
+      /* the peer is connecting. accept it and wait for its data */
+      if(PEER(channel, index[i])->listener >= 0)
+      {
+        Accept(channel, index[i]);
+        p[i].fd = FD(channel, index[i]);
+        continue;
+      }
+
+      /* the message (or the peer error) is there */
+      result = index[i];
+    }
+  }
+
+  g_free(p);
+  g_free(index);
+  return result;
+}
+
+/*
+ * ask the writer to stop. the writer notices it when the socket is full
+ * and sends EOF after the current message, so only the data already in
+ * flight has to be read
+ */
+static void Cancel(struct ChannelDesc *channel, int n)
+{
+  char c = CANCEL;
+
+  Accept(channel, n);
+  ZLOGIF(send(FD(channel, n), &c, sizeof c, MSG_NOSIGNAL) != sizeof c,
+      "cannot cancel %s;%d: %s", channel->alias, n, strerror(errno));
+}
+
+/* send the message: size header and data */
+static void SendMessage(struct ChannelDesc *channel, int n,
+    const char *buf, int32_t size)
+{
+  uint32_t header = htonl(size);
+  int flags = 0;
+
+  ZLOGS(LOG_INSANE, "SendMessage to %s;%d", channel->alias, n);
+  if(PEER(channel, n)->zerocopy && size >= ZEROCOPY_LIMIT)
+    flags = MSG_ZEROCOPY;
+
+  Send(channel, n, (char*)&header, sizeof header, size > 0 ? MSG_MORE : 0);
+  Send(channel, n, buf, size, flags);
+}
+
+static int32_t TcpSendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
+{
+  int32_t writerest;
+  int32_t msgsize;
+
+  assert(channel != NULL);
+  assert(buf != NULL);
+
+  /* send a buffer through the multiple messages */
+  ZLOGS(LOG_INSANE, "send(): channel %s;%d, buffer=0x%lx, size=%d",
+      channel->alias, n, (intptr_t)buf, count);
+  msgsize = channel->options[OptMsgSize];
+  for(writerest = count; writerest > 0; writerest -= msgsize)
+  {
+    int32_t towrite = MIN(writerest, msgsize);
+
+    /* the reader does not need the data, pretend it is sent */
+    if(!PEER(channel, n)->cancelled) TakeCancel(channel, n);
+    if(PEER(channel, n)->cancelled) break;
+    SendMessage(channel, n, buf, towrite);
+    buf += towrite;
+  }
+
+  /* the user data should not be in use after return */
+  WaitCompletion(channel, n);
+  return count;
+}
+
+static void TcpChannelCtor(struct ChannelDesc *channel, int n)
+{
+  assert(channel != NULL);
+  assert(n < channel->source->len);
+
+  ZLOGS(LOG_DEBUG, "prefetch %s;%d", channel->alias, n);
+  ZLOGFAIL((uint32_t)CH_RW_TYPE(channel) - 1 > 1, EFAULT, "invalid i/o type");
+  ZLOGFAIL(channel->options[OptMsgSize] == 0
+      || channel->options[OptMsgSize] > MSG_SIZE_LIMIT, EFAULT,
+      "invalid message size for %s", channel->alias);
+  CH_FLAGS(channel, n) |= (CH_RW_TYPE(channel) - 1) << 1;
+
+  CH_BACKUP(channel, n) = g_malloc0(sizeof(struct Peer));
+  PEER(channel, n)->listener = -1;
+
+  /* allocate one message per channel */
+  if(channel->msg == NULL && IS_RO(channel))
+    channel->msg = g_malloc0(sizeof(struct Message));
+
+  /* bind or connect the channel */
+  IS_RO(channel) ? Bind(channel, n) : Connect(channel, n);
+}
+
+static void TcpChannelDtor(struct ChannelDesc *channel, int n)
+{
+  char buf[TAG_DIGEST_SIZE + 1] = "disabled", *digest = buf;
+  int dsize = 0;
+
+  /* skip source closing if session is broken */
+  if(GetExitCode() != 0) return;
+
+  assert(channel != NULL);
+  assert(n < channel->source->len);
+  assert(CH_HANDLE(channel, n) != NULL);
+  ZLOGS(LOG_DEBUG, "closing %s;%d", channel->alias, n);
+
+  /* close WO source (send EOF and digest) */
+  if(IS_WO(channel))
+  {
+    channel->eof = 1;
+    SendMessage(channel, n, digest, 0);
+    if(channel->tag != NULL)
+    {
+      TagDigest(channel->tag, digest);
+      dsize = TAG_DIGEST_SIZE;
+    }
+    SendMessage(channel, n, digest, dsize);
+    CountPut(CH_CONN(channel, n), 0);
+  }
+  /* close RO source, "fast forward" to EOF if needed */
+  else
+  {
+    if(CH_CONN(channel, n)->pos < channel->getpos)
+      channel->eof = 0;
+
+    /* stop the writer, then read until EOF (to avoid hanging it) */
+    if(channel->eof == 0) Cancel(channel, n);
+    for(; channel->eof == 0; TcpFetchMessage(channel, n, 0))
+    {
+      if(n == 0) channel->getpos += channel->bufend;
+      CH_CONN(channel, n)->pos += channel->bufend;
+      CountGet(CH_CONN(channel, n), channel->bufend);
+    }
+  }
+
+  /* close source */
+  close(FD(channel, n));
+  CH_HANDLE(channel, n) = NULL;
+  g_free(CH_BACKUP(channel, n));
+  CH_BACKUP(channel, n) = NULL;
+}
+
+struct Transport const kTcpTransport = {
+  "tcp",
+  PROTO_BIT(NTCP),
+  TcpNetCtor,
+  TcpNetDtor,
+  TcpChannelCtor,
+  TcpChannelDtor,
+  NULL,
+  TcpMessageData,
+  TcpFreeMessage,
+  TcpFetchMessage,
+  TcpSendData,
+  NULL,
+  TcpPoll,
+};
@@ -25,31 +25,25 @@
 #define NET_BUFFER_SIZE BUFFER_SIZE
 #define ERROR(code) ZLOGIF(code, "failed: %s", udt_getlasterror_desc())
 #define MAX_CONN 1
+#define MSG_SIZE_LIMIT 0x10000000
 
 /*
- * accept "bind" channels. since udt_accept() is a blocking thing
+ * accept "bind" source. since udt_accept() is a blocking thing
  * the function should be used *only* after other channels are mounted
- * TODO(d'b): remove it after "channels" re-design
  */
-void PrefetchAccept(struct ChannelDesc *channel)
+static void UdtAccept(struct ChannelDesc *channel, int n)
 {
-  int n;
   int result;
   struct sockaddr_in incoming;
 
   /* skip inappropriate channels */
   if(!IS_RO(channel)) return;
 
-  for(n = 0; n < channel->source->len; ++n)
-  {
-    if(IS_FILE(CH_CONN(channel, n))) continue;
-
-    result = udt_accept(GPOINTER_TO_INT(CH_HANDLE(channel, n)),
-        (struct sockaddr*)&incoming, &result);
-    CH_HANDLE(channel, n) = GINT_TO_POINTER(result);
-    ZLOGFAIL(GPOINTER_TO_INT(CH_HANDLE(channel, n)) == UDT_INVALID_SOCK, EFAULT,
-        "bind %s;%d: %s", channel->alias, n, udt_getlasterror_desc());
-  }
+  result = udt_accept(GPOINTER_TO_INT(CH_HANDLE(channel, n)),
+      (struct sockaddr*)&incoming, &result);
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(result);
+  ZLOGFAIL(GPOINTER_TO_INT(CH_HANDLE(channel, n)) == UDT_INVALID_SOCK, EFAULT,
+      "bind %s;%d: %s", channel->alias, n, udt_getlasterror_desc());
 }
 
 /* bind the RO source */
@@ -105,25 +99,25 @@ static void Connect(struct ChannelDesc *channel, int n, struct addrinfo *local)
       channel->alias, n, udt_getlasterror_desc());
 }
 
-void NetCtor(const struct Manifest *manifest)
+static void UdtNetCtor(const struct Manifest *manifest)
 {
   ZLOG(LOG_DEBUG, "NetCtor: udt");
   ZLOGFAIL(udt_startup() != 0, EFAULT, "udt: %s", udt_getlasterror_desc());
 }
 
-void NetDtor(struct Manifest *manifest)
+static void UdtNetDtor(struct Manifest *manifest)
 {
   ZLOG(LOG_DEBUG, "NetDtor: udt");
   ZLOGFAIL(udt_cleanup() != 0, EFAULT, "udt: %s", udt_getlasterror_desc());
 }
 
-char *MessageData(struct ChannelDesc *channel)
+static char *UdtMessageData(struct ChannelDesc *channel)
 {
   ZLOG(LOG_DEBUG, "MessageData: %s", channel->alias);
   return channel->msg;
 }
 
-void FreeMessage(struct ChannelDesc *channel)
+static void UdtFreeMessage(struct ChannelDesc *channel)
 {
   ZLOG(LOG_DEBUG, "FreeMessage: %s", channel->alias);
   if(IS_RO(channel)) g_free(channel->msg);
@@ -151,24 +145,23 @@ static void GetMessage(struct ChannelDesc *channel, int n, int size)
     channel->eof = 1;
 }
 
-void FetchMessage(struct ChannelDesc *channel, int n)
+static void UdtFetchMessage(struct ChannelDesc *channel, int n, int size)
 {
   ZLOGS(LOG_INSANE, "FetchMessage: %s;%d", channel->alias, n);
 
   /*
-   * ->bufpos contains read size to workaround problem with
-   * incomplete messages (usual case for udt).
-   * TODO(d'b): rewrite it when 0mq support will be removed
+   * udt is a stream: read the wanted size to avoid incomplete messages.
+   * the message buffer is limited, the bigger reads (compressed frames)
+   * get the data by parts
    */
-  assert(channel->bufpos <= NET_BUFFER_SIZE);
-  assert(channel->bufpos > 0);
+  assert(size > 0);
 
   /* get message */
   if(!channel->eof)
-    GetMessage(channel, n, channel->bufpos);
+    GetMessage(channel, n, MIN(size, NET_BUFFER_SIZE));
 }
 
-int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
+static int32_t UdtSendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
 {
   int i;
   int pos;
@@ -183,7 +176,7 @@ int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t co
   /* send a buffer through the multiple messages */
   for(pos = 0; pos < count; pos += i)
   {
-    i = MIN(NET_BUFFER_SIZE, count - pos);
+    i = MIN(channel->options[OptMsgSize], count - pos);
     i = udt_send(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buf + pos, i, 0);
     ZLOGFAIL(i < 0, EFAULT, "send: %s", udt_getlasterror_desc());
   }
@@ -191,51 +184,7 @@ int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t co
   return count;
 }
 
-void SyncSource(struct ChannelDesc *channel, int n)
-{
-  if(!CH_SEQ_READABLE(channel)) return;
-
-  ZLOGS(LOG_INSANE, "SyncSource: %s;%d before skip pos = %ld, getpos = %ld",
-      channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
-
-  /* if source is a pipe read (*->getpos - *->pos) bytes */
-  if(CH_PROTO(channel, n) == ProtoFIFO || CH_PROTO(channel, n) == ProtoCharacter)
-  {
-    int result;
-    while(CH_CONN(channel, n)->pos < channel->getpos)
-    {
-      char buf[BUFFER_SIZE];
-      result = fread(buf, 1, channel->getpos - CH_CONN(channel, n)->pos,
-          CH_HANDLE(channel, n));
-      ZLOGFAIL(result < 0, EIO, "%s;%d: %s", channel->alias, n, strerror(errno));
-      CH_CONN(channel, n)->pos += result;
-    }
-  }
-
-  /* if source is a network get over (*->getpos - *->pos) bytes */
-  else if(IS_NETWORK(CH_CONN(channel, n)))
-  {
-    channel->eof = 0;
-    while(CH_CONN(channel, n)->pos < channel->getpos && !channel->eof)
-    {
-      int size = channel->getpos - CH_CONN(channel, n)->pos;
-      GetMessage(channel, n, size < NET_BUFFER_SIZE ? size : NET_BUFFER_SIZE);
-      CH_CONN(channel, n)->pos += channel->bufend;
-    }
-  }
-
-  /* no need to sync with regular files, just set (*->getpos to *->pos) */
-  else
-    CH_CONN(channel, n)->pos = channel->getpos;
-
-  ZLOGS(LOG_INSANE, "%s;%d skipped pos = %ld, getpos = %ld",
-      channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
-  ZLOGFAIL(CH_CONN(channel, n)->pos != channel->getpos, EPIPE,
-      "%s;%d is out of sync: %ld:%ld", channel->alias, n,
-      CH_CONN(channel, n)->pos, channel->getpos);
-}
-
-void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
+static void UdtChannelCtor(struct ChannelDesc *channel, int n)
 {
   int i;
   char *ip;
@@ -250,6 +199,9 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
 
   /* choose socket type */
   ZLOGFAIL((uint32_t)CH_RW_TYPE(channel) - 1 > 1, EFAULT, "invalid i/o type");
+  ZLOGFAIL(channel->options[OptMsgSize] == 0
+      || channel->options[OptMsgSize] > MSG_SIZE_LIMIT, EFAULT,
+      "invalid message size for %s", channel->alias);
   CH_FLAGS(channel, n) |= (CH_RW_TYPE(channel) - 1) << 1;
 
   /* get address structure via "hint" to "local" */
@@ -285,7 +237,7 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
   freeaddrinfo(local);
 }
 
-void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
+static void UdtChannelDtor(struct ChannelDesc *channel, int n)
 {
   /* skip source closing if session is broken */
   if(GetExitCode() != 0) return;
@@ -318,3 +270,19 @@ void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
   CH_BACKUP(channel, n) = NULL;
   ZLOGS(LOG_DEBUG, "%s;%d closed", channel->alias, n);
 }
+
+struct Transport const kUdtTransport = {
+  "udt",
+  PROTO_BIT(UDT),
+  UdtNetCtor,
+  UdtNetDtor,
+  UdtChannelCtor,
+  UdtChannelDtor,
+  UdtAccept,
+  UdtMessageData,
+  UdtFreeMessage,
+  UdtFetchMessage,
+  UdtSendData,
+  NULL,
+  NULL,
+};
@@ -16,12 +16,20 @@
 
 #include <assert.h>
 #include <arpa/inet.h> /* convert ip <-> int */
+#include <pthread.h>
+#include <unistd.h>
 #include <zmq.h>
 #include "src/channels/prefetch.h"
 #include "src/main/accounting.h"
 #include "src/main/report.h"
 
 #define NET_BUFFER_SIZE BUFFER_SIZE
+#define ZEROCOPY_LIMIT 0x2000 /* smaller messages are copied */
+#define MSG_SIZE_LIMIT 0x10000000
+#define CONTROL_URL "tcp://%s:0" /* the writer control socket */
+#define TOKEN_SIZE 16 /* random bytes of the cancellation token */
+#define TOKEN_LENGTH (TOKEN_SIZE * 2) /* the token in hex */
+#define CONTROL_LINGER 1000 /* milliseconds to deliver the cancellation */
 #define ZMQ_ERR(code) ZLOGIF(code < 0, "failed: %s", zmq_strerror(zmq_errno()))
 
 /* TODO(d'b): find more neat solution than put it twice */
@@ -32,6 +40,39 @@
 
 static void *context = NULL; /* zeromq context */
 
+/* small writes accumulator (see "Batch" channel option) */
+struct Batch {
+  struct ChannelDesc *channel;
+  int n;
+  int32_t size;
+  char *data;
+};
+
+static GPtrArray *batches = NULL; /* all (struct Batch*) */
+
+/*
+ * source internals (stored in the connection "backup"). push/pull has
+ * no way back, so the writer binds the control socket to the address of
+ * the data connection and sends its url and the random token with the
+ * 1st message. the reader closing the channel before eof sends the token
+ * there and the writer stops sending the data. the control socket can be
+ * reached by anyone, so the messages without the token are ignored
+ */
+struct Peer {
+  struct Batch *batch; /* WO: batching or NULL */
+  void *control; /* WO: control socket */
+  int cancelled; /* WO: the reader does not need the data */
+  char *url; /* RO: the writer control url or NULL if not received yet */
+  char token[TOKEN_LENGTH + 1]; /* the cancellation token */
+};
+
+#define PEER(channel, n) ((struct Peer*)CH_BACKUP(channel, n))
+
+/* zero copy messages which are not released by 0mq yet */
+static int pending = 0;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+
 /* return connection url. returned string must be freed with g_free */
 static char *MakeURL(struct ChannelDesc *channel, int n)
 {
@@ -56,6 +97,15 @@ static char *MakeURL(struct ChannelDesc *channel, int n)
   return url;
 }
 
+/* set integer 0mq socket option from the channel option (if not 0) */
+static void SetOption(struct ChannelDesc *channel, int n, int name, int option)
+{
+  int value = channel->options[option];
+
+  if(value == 0) return;
+  ZMQ_ERR(zmq_setsockopt(CH_HANDLE(channel, n), name, &value, sizeof value));
+}
+
 /* bind the RO source */
 static void Bind(struct ChannelDesc *channel, int n)
 {
@@ -64,6 +114,10 @@ static void Bind(struct ChannelDesc *channel, int n)
   size_t size = sizeof port;
   char *url = MakeURL(channel, n);
 
+  /* set queue and kernel buffer sizes */
+  SetOption(channel, n, ZMQ_RCVHWM, OptRcvHwm);
+  SetOption(channel, n, ZMQ_RCVBUF, OptRcvBuf);
+
   /* bind to 1st available port */
   result = zmq_bind(CH_HANDLE(channel, n), url);
   g_free(url);
@@ -82,24 +136,78 @@ static void Bind(struct ChannelDesc *channel, int n)
 static void Connect(struct ChannelDesc *channel, int n)
 {
   char *url;
-  int hwm = 1;
   void *h = CH_HANDLE(channel, n);
 
-  ZMQ_ERR(zmq_setsockopt(h, ZMQ_SNDHWM, &hwm, sizeof hwm));
+  /* set queue and kernel buffer sizes */
+  SetOption(channel, n, ZMQ_SNDHWM, OptSndHwm);
+  SetOption(channel, n, ZMQ_SNDBUF, OptSndBuf);
+
+  /* enable batching if asked */
+  if(channel->options[OptBatch] > 0)
+  {
+    struct Batch *b = g_malloc0(sizeof *b);
+    b->channel = channel;
+    b->n = n;
+    b->data = g_malloc(channel->options[OptBatch]);
+    PEER(channel, n)->batch = b;
+    g_ptr_array_add(batches, b);
+  }
+
   url = MakeURL(channel, n);
   ZLOGS(LOG_DEBUG, "connect url %s to %s;%d", url, channel->alias, n);
   ZMQ_ERR(zmq_connect(h, url));
   g_free(url);
 }
 
-void NetCtor(const struct Manifest *manifest)
+/* return the local ip (network order) the WO source peer can reach */
+static uint32_t LocalAddress(struct ChannelDesc *channel, int n)
+{
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof addr;
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+  /* udp "connect" only chooses the route, nothing is sent */
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = CH_HOST(channel, n);
+  addr.sin_port = htons(CH_PORT(channel, n));
+  if(s < 0 || connect(s, (struct sockaddr*)&addr, sizeof addr) < 0
+      || getsockname(s, (struct sockaddr*)&addr, &size) < 0)
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if(s >= 0) close(s);
+  return addr.sin_addr.s_addr;
+}
+
+/*
+ * return the number of 0mq i/o threads: one per stripe of the widest
+ * striped channel (but not more than cores), so the stripes are served
+ * in parallel. other channels are fine with the default one thread
+ */
+static int IOThreads(const struct Manifest *manifest)
+{
+  int result = 1;
+  int i;
+
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    if(channel->options[OptMode] == ModeStripe)
+      result = MAX(result, channel->source->len);
+  }
+  return MIN(result, MAX(sysconf(_SC_NPROCESSORS_ONLN), 1));
+}
+
+static void ZmqNetCtor(const struct Manifest *manifest)
 {
   /* get zmq context */
   context = zmq_ctx_new();
   ZLOGFAIL(context == NULL, EFAULT, "cannot initialize zeromq context");
+  ZMQ_ERR(zmq_ctx_set(context, ZMQ_IO_THREADS, IOThreads(manifest)));
+  batches = g_ptr_array_new();
 }
 
-void NetDtor(struct Manifest *manifest)
+static void ZmqNetDtor(struct Manifest *manifest)
 {
   /* don't terminate if session is broken */
   if(GetExitCode() != 0) return;
@@ -110,14 +218,16 @@ void NetDtor(struct Manifest *manifest)
    */
   zmq_ctx_term(context);
   context = NULL;
+  g_ptr_array_free(batches, TRUE);
+  batches = NULL;
 }
 
-char *MessageData(struct ChannelDesc *channel)
+static char *ZmqMessageData(struct ChannelDesc *channel)
 {
   return (char*)zmq_msg_data(channel->msg);
 }
 
-void FreeMessage(struct ChannelDesc *channel)
+static void ZmqFreeMessage(struct ChannelDesc *channel)
 {
   int result;
 
@@ -132,23 +242,75 @@ void FreeMessage(struct ChannelDesc *channel)
   ZMQ_ERR(result);
 }
 
+static void SendMessage(struct ChannelDesc *channel, int n);
+
+/* 0mq i/o thread callback: batch is sent */
+static void FreeBatch(void *data, void *hint)
+{
+  g_free(data);
+}
+
+/* send accumulated data (if any) giving the batch buffer to 0mq */
+static void FlushBatch(struct Batch *b)
+{
+  if(b->size == 0) return;
+
+  ZMQ_ERR(zmq_msg_init_data(b->channel->msg, b->data, b->size, FreeBatch, NULL));
+  SendMessage(b->channel, b->n);
+  b->data = g_malloc(b->channel->options[OptBatch]);
+  b->size = 0;
+}
+
+/*
+ * send all accumulated data. must be called before any blocking read
+ * to avoid deadlock when the peer waits for the batched data
+ */
+static void FlushBatches()
+{
+  int i;
+
+  if(batches == NULL) return;
+  for(i = 0; i < batches->len; ++i)
+    FlushBatch(g_ptr_array_index(batches, i));
+}
+
+/* receive the writer control url and token (the 1st message of RO source) */
+static void TakeURL(struct ChannelDesc *channel, int n)
+{
+  struct Peer *p = PEER(channel, n);
+  char *token;
+
+  ZMQ_ERR(zmq_msg_recv(channel->msg, CH_HANDLE(channel, n), 0));
+  p->url = g_strndup(ZmqMessageData(channel), zmq_msg_size(channel->msg));
+
+  token = strrchr(p->url, ' ');
+  ZLOGFAIL(token == NULL || strlen(token + 1) != TOKEN_LENGTH, EPIPE,
+      "%s;%d got invalid control url", channel->alias, n);
+  *token++ = '\0';
+  g_strlcpy(p->token, token, sizeof p->token);
+}
+
 /* get the next message. updates channel->msg (and indices) */
 static void GetMessage(struct ChannelDesc *channel, int n)
 {
   ZLOGS(LOG_INSANE, "GetMessage of %s;%d", channel->alias, n);
 
+  /* skip the writer control url */
+  if(PEER(channel, n)->url == NULL) TakeURL(channel, n);
+
   /* receive the next message and rewind buffer */
   ZMQ_ERR(zmq_msg_recv(channel->msg, CH_HANDLE(channel, n), 0));
   channel->bufend = zmq_msg_size(channel->msg);
   channel->bufpos = 0;
 }
 
-void FetchMessage(struct ChannelDesc *channel, int n)
+static void ZmqFetchMessage(struct ChannelDesc *channel, int n, int size)
 {
   ZLOGS(LOG_INSANE, "FetchMessage of %s;%d", channel->alias, n);
 
   /* get message */
   if(channel->eof) return;
+  FlushBatches();
   GetMessage(channel, n);
 
   /* if EOF detected get the 2nd part */
@@ -162,82 +324,323 @@ void FetchMessage(struct ChannelDesc *channel, int n)
         "invalid EOF size = %d", channel->bufend);
 }
 
-/* send message "channel->msg" */
+static int ZmqPoll(struct ChannelDesc *channel, const uint8_t *open, int start)
+{
+  int len = channel->source->len;
+  zmq_pollitem_t *items = g_malloc0(len * sizeof *items);
+  int *index = g_malloc(len * sizeof *index);
+  int result = -1;
+  int count = 0;
+  int i;
+
+  /* poll "open" sources in turn beginning from "start" */
+  for(i = 0; i < len; ++i)
+    if(open[(start + i) % len])
+    {
+      index[count] = (start + i) % len;
+      items[count].socket = CH_HANDLE(channel, index[count]);
+      items[count++].events = ZMQ_POLLIN;
+    }
+
+  FlushBatches();
+  while(result < 0)
+  {
+    ZLOGFAIL(zmq_poll(items, count, -1) < 0 && zmq_errno() != EINTR, EIO,
+        "%s poll failed: %s", channel->alias, zmq_strerror(zmq_errno()));
+    for(i = 0; i < count && result < 0; ++i)
+    {
+      if(!(items[i].revents & ZMQ_POLLIN)) continue;
+
+      /* the control url is not the data, poll again */
+      if(PEER(channel, index[i])->url == NULL)
+        TakeURL(channel, index[i]);
+      else
+        result = index[i];
+    }
+  }
+
+  g_free(items);
+  g_free(index);
+  return result;
+}
+
+/* take the reader cancellation if any. return 1 if cancelled */
+static int TakeCancel(struct ChannelDesc *channel, int n)
+{
+  struct Peer *p = PEER(channel, n);
+  char token[TOKEN_LENGTH];
+  int size;
+
+  if(p->cancelled) return 1;
+  while((size = zmq_recv(p->control, token, sizeof token, ZMQ_DONTWAIT)) >= 0)
+  {
+    if(size == sizeof token && memcmp(token, p->token, sizeof token) == 0)
+    {
+      p->cancelled = 1;
+      ZLOGS(LOG_DEBUG, "%s;%d is cancelled", channel->alias, n);
+      return 1;
+    }
+    ZLOG(LOG_ERROR, "%s;%d got invalid cancellation", channel->alias, n);
+  }
+  return 0;
+}
+
+/* wait until the WO source can send watching for the cancellation */
+static void WaitWritable(struct ChannelDesc *channel, int n)
+{
+  zmq_pollitem_t items[2] = {{0}};
+
+  items[0].socket = CH_HANDLE(channel, n);
+  items[0].events = ZMQ_POLLOUT;
+  items[1].socket = PEER(channel, n)->control;
+  items[1].events = ZMQ_POLLIN;
+
+  ZLOGFAIL(zmq_poll(items, PEER(channel, n)->cancelled ? 1 : 2, -1) < 0
+      && zmq_errno() != EINTR, EIO, "%s;%d poll failed: %s",
+      channel->alias, n, zmq_strerror(zmq_errno()));
+  if(items[1].revents & ZMQ_POLLIN) TakeCancel(channel, n);
+}
+
+/*
+ * send message "channel->msg". the data of the cancelled source is
+ * dropped, eof (channel->eof is set) is sent anyway
+ */
 static void SendMessage(struct ChannelDesc *channel, int n)
 {
+  int result;
+
   ZLOGS(LOG_INSANE, "SendMessage to %s;%d", channel->alias, n);
-  ZMQ_ERR(zmq_msg_send(channel->msg, CH_HANDLE(channel, n), 0));
+  for(;;)
+  {
+    if(channel->eof == 0 && PEER(channel, n)->cancelled)
+    {
+      zmq_msg_close(channel->msg);
+      return;
+    }
+
+    result = zmq_msg_send(channel->msg, CH_HANDLE(channel, n), ZMQ_DONTWAIT);
+    if(result >= 0 || zmq_errno() != EAGAIN) break;
+    WaitWritable(channel, n);
+  }
+  ZMQ_ERR(result);
+
+  /* not sent message still owns the data */
+  if(result < 0) zmq_msg_close(channel->msg);
 }
 
-int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
+/* fill "token" with the random hex string */
+static void MakeToken(struct ChannelDesc *channel, int n, char *token)
+{
+  unsigned char random[TOKEN_SIZE];
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  int i;
+
+  ZLOGFAIL(fd < 0 || read(fd, random, sizeof random) != sizeof random,
+      EFAULT, "cannot get %s;%d token: %s", channel->alias, n, strerror(errno));
+  close(fd);
+  for(i = 0; i < TOKEN_SIZE; ++i)
+    g_snprintf(token + 2 * i, 3, "%02x", random[i]);
+}
+
+/*
+ * bind the WO source control socket to the address the peer connects
+ * from and send its url with the cancellation token to the reader
+ */
+static void Control(struct ChannelDesc *channel, int n)
+{
+  struct Peer *p = PEER(channel, n);
+  char url[BIG_ENOUGH_STRING];
+  size_t size = sizeof url;
+  int64_t limit = TOKEN_LENGTH;
+  struct in_addr ip;
+  char *control;
+  int linger = 0;
+  int result;
+
+  p->control = zmq_socket(context, ZMQ_PULL);
+  ZLOGFAIL(p->control == NULL, EFAULT,
+      "cannot get control socket for %s;%d", channel->alias, n);
+  ZMQ_ERR(zmq_setsockopt(p->control, ZMQ_LINGER, &linger, sizeof linger));
+  ZMQ_ERR(zmq_setsockopt(p->control, ZMQ_MAXMSGSIZE, &limit, sizeof limit));
+
+  ip.s_addr = LocalAddress(channel, n);
+  control = g_strdup_printf(CONTROL_URL, inet_ntoa(ip));
+  result = zmq_bind(p->control, control);
+  g_free(control);
+  ZLOGFAIL(result != 0
+      || zmq_getsockopt(p->control, ZMQ_LAST_ENDPOINT, url, &size) != 0,
+      EFAULT, "cannot bind control socket for %s;%d: %s",
+      channel->alias, n, zmq_strerror(zmq_errno()));
+
+  MakeToken(channel, n, p->token);
+  control = g_strdup_printf("%s %s", url, p->token);
+  ZLOGS(LOG_DEBUG, "control url %s for %s;%d", url, channel->alias, n);
+
+  ZMQ_ERR(zmq_msg_init_size(channel->msg, strlen(control)));
+  memcpy(ZmqMessageData(channel), control, strlen(control));
+  SendMessage(channel, n);
+  g_free(control);
+}
+
+/* ask the writer of RO source to stop sending */
+static void Cancel(struct ChannelDesc *channel, int n)
+{
+  struct Peer *p = PEER(channel, n);
+  int linger = CONTROL_LINGER;
+  void *s;
+
+  if(p->url == NULL) TakeURL(channel, n);
+  s = zmq_socket(context, ZMQ_PUSH);
+  if(s == NULL) return;
+
+  /* the writer may be gone already, do not wait for it too long */
+  ZMQ_ERR(zmq_setsockopt(s, ZMQ_LINGER, &linger, sizeof linger));
+  if(zmq_connect(s, p->url) == 0)
+    ZMQ_ERR(zmq_send(s, p->token, TOKEN_LENGTH, ZMQ_DONTWAIT));
+  zmq_close(s);
+  ZLOGS(LOG_DEBUG, "%s;%d is cancelled", channel->alias, n);
+}
+
+/* count the zero copy message created */
+static void Pending()
+{
+  pthread_mutex_lock(&pending_lock);
+  ++pending;
+  pthread_mutex_unlock(&pending_lock);
+}
+
+/* 0mq i/o thread callback: zero copy message is sent */
+static void Release(void *data, void *hint)
+{
+  pthread_mutex_lock(&pending_lock);
+  if(--pending == 0) pthread_cond_signal(&pending_cond);
+  pthread_mutex_unlock(&pending_lock);
+}
+
+/* wait until 0mq releases all user data */
+static void WaitReleased()
+{
+  pthread_mutex_lock(&pending_lock);
+  while(pending > 0)
+    pthread_cond_wait(&pending_cond, &pending_lock);
+  pthread_mutex_unlock(&pending_lock);
+}
+
+/*
+ * big messages refer the user data directly (no copy). the data is
+ * owned by 0mq until Release() so the function waits for all messages
+ * to be released: the user cannot change the data being sent
+ */
+static int32_t ZmqSendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count)
 {
   int32_t writerest;
+  int32_t msgsize;
+
+  struct Batch *b;
 
   assert(channel != NULL);
   assert(channel->msg != NULL);
   assert(buf != NULL);
 
+  /* the reader does not need the data, pretend it is sent */
+  if(TakeCancel(channel, n)) return count;
+
+  /* accumulate small writes if batching enabled */
+  b = PEER(channel, n)->batch;
+  if(b != NULL)
+  {
+    if(b->size + count > channel->options[OptBatch]) FlushBatch(b);
+    if(count < channel->options[OptBatch])
+    {
+      memcpy(b->data + b->size, buf, count);
+      b->size += count;
+      return count;
+    }
+  }
+
   /* send a buffer through the multiple messages */
   ZLOGS(LOG_INSANE, "send(): channel %s;%d, buffer=0x%lx, size=%d",
       channel->alias, n, (intptr_t)buf, count);
-  for(writerest = count; writerest > 0; writerest -= NET_BUFFER_SIZE)
+  msgsize = channel->options[OptMsgSize];
+  for(writerest = count; writerest > 0; writerest -= msgsize)
   {
-    int32_t towrite = MIN(writerest, NET_BUFFER_SIZE);
+    int32_t towrite = MIN(writerest, msgsize);
+
+    /* the reader does not need the data, pretend it is sent */
+    if(TakeCancel(channel, n)) break;
 
     /* create the message */
-    ZMQ_ERR(zmq_msg_init_size(channel->msg, towrite));
-    memcpy(MessageData(channel), buf, towrite);
+    if(towrite < ZEROCOPY_LIMIT)
+    {
+      ZMQ_ERR(zmq_msg_init_size(channel->msg, towrite));
+      memcpy(ZmqMessageData(channel), buf, towrite);
+    }
+    else if(zmq_msg_init_data(channel->msg, (void*)buf, towrite, Release, NULL) == 0)
+      Pending();
+    else
+      ZMQ_ERR(-1);
 
     /* send the message */
     SendMessage(channel, n);
     buf += towrite;
   }
 
+  WaitReleased();
   return count;
 }
 
-void SyncSource(struct ChannelDesc *channel, int n)
+/*
+ * send the data to all sources. each message is created once, the
+ * sources get its copies sharing the data
+ */
+static int32_t ZmqBroadcast(struct ChannelDesc *channel, const char *buf, int32_t count)
 {
-  if(!CH_SEQ_READABLE(channel)) return;
+  int32_t writerest;
+  int32_t msgsize;
+  int n;
 
-  ZLOGS(LOG_INSANE, "%s;%d before skip pos = %ld, getpos = %ld",
-      channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
+  /* batches belong to the sources */
+  if(PEER(channel, 0)->batch != NULL)
+  {
+    for(n = 0; n < channel->source->len; ++n)
+      ZmqSendData(channel, n, buf, count);
+    return count;
+  }
 
-  /* if source is a pipe read (*->getpos - *->pos) bytes */
-  if(CH_PROTO(channel, n) == ProtoFIFO || CH_PROTO(channel, n) == ProtoCharacter)
+  msgsize = channel->options[OptMsgSize];
+  for(writerest = count; writerest > 0; writerest -= msgsize)
   {
-    int result;
-    while(CH_CONN(channel, n)->pos < channel->getpos)
+    int32_t towrite = MIN(writerest, msgsize);
+    zmq_msg_t msg;
+
+    /* create the message */
+    if(towrite < ZEROCOPY_LIMIT)
     {
-      char buf[BUFFER_SIZE];
-      result = fread(buf, 1, channel->getpos - CH_CONN(channel, n)->pos,
-          CH_HANDLE(channel, n));
-      ZLOGFAIL(result < 0, EIO, "%s;%d: %s", channel->alias, n, strerror(errno));
-      CH_CONN(channel, n)->pos += result;
+      ZMQ_ERR(zmq_msg_init_size(&msg, towrite));
+      memcpy(zmq_msg_data(&msg), buf, towrite);
     }
-  }
+    else if(zmq_msg_init_data(&msg, (void*)buf, towrite, Release, NULL) == 0)
+      Pending();
+    else
+      ZMQ_ERR(-1);
 
-  /* if source is a network get over (*->getpos - *->pos) bytes */
-  else if(IS_NETWORK(CH_CONN(channel, n)))
-  {
-    while(CH_CONN(channel, n)->pos < channel->getpos && !channel->eof)
+    /* send the copies. the data is released with the last one */
+    for(n = 0; n < channel->source->len; ++n)
     {
-      FetchMessage(channel, n);
-      CH_CONN(channel, n)->pos += channel->bufend;
+      if(TakeCancel(channel, n)) continue;
+      ZMQ_ERR(zmq_msg_init(channel->msg));
+      ZMQ_ERR(zmq_msg_copy(channel->msg, &msg));
+      SendMessage(channel, n);
     }
+    ZMQ_ERR(zmq_msg_close(&msg));
+    buf += towrite;
   }
 
-  /* no need to sync with regular files, just set (*->getpos to *->pos) */
-  else
-    CH_CONN(channel, n)->pos = channel->getpos;
-
-  ZLOGS(LOG_INSANE, "%s;%d skipped pos = %ld, getpos = %ld",
-      channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
-  ZLOGFAIL(CH_CONN(channel, n)->pos != channel->getpos,
-      EPIPE, "%s;%d is out of sync", channel->alias, n);
+  WaitReleased();
+  return count;
 }
 
-void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
+static void ZmqChannelCtor(struct ChannelDesc *channel, int n)
 {
   int sock_type;
   struct Connection *c;
@@ -252,6 +655,10 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
 
   /* choose socket type */
   ZLOGFAIL((uint32_t)CH_RW_TYPE(channel) - 1 > 1, EFAULT, "invalid i/o type");
+  ZLOGFAIL(channel->options[OptMsgSize] == 0
+      || channel->options[OptMsgSize] > MSG_SIZE_LIMIT
+      || channel->options[OptBatch] > MSG_SIZE_LIMIT, EFAULT,
+      "invalid message size for %s", channel->alias);
   CH_FLAGS(channel, n) |= (CH_RW_TYPE(channel) - 1) << 1;
   sock_type = IS_RO(channel) ? ZMQ_PULL : ZMQ_PUSH;
 
@@ -268,10 +675,17 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
   }
 
   /* bind or connect the channel */
-  sock_type == ZMQ_PULL ? Bind(channel, n) : Connect(channel, n);
+  CH_BACKUP(channel, n) = g_malloc0(sizeof(struct Peer));
+  if(sock_type == ZMQ_PULL)
+    Bind(channel, n);
+  else
+  {
+    Connect(channel, n);
+    Control(channel, n);
+  }
 }
 
-void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
+static void ZmqChannelDtor(struct ChannelDesc *channel, int n)
 {
   char *url; /* debug purposes only */
   char buf[TAG_DIGEST_SIZE + 1] = "disabled", *digest = buf;
@@ -292,6 +706,17 @@ void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
   /* close WO source (send EOF) */
   if(IS_WO(channel))
   {
+    /* send and release the batch */
+    if(PEER(channel, n)->batch != NULL)
+    {
+      struct Batch *b = PEER(channel, n)->batch;
+      FlushBatch(b);
+      g_ptr_array_remove(batches, b);
+      g_free(b->data);
+      g_free(b);
+      PEER(channel, n)->batch = NULL;
+    }
+
     /* 1st EOF part */
     channel->eof = 1;
     ZMQ_ERR(zmq_msg_init_data(channel->msg, digest, 0, NULL, NULL));
@@ -313,22 +738,21 @@ void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
 
     /* only for the last source */
     if(n == channel->source->len - 1)
-      FreeMessage(channel);
+      ZmqFreeMessage(channel);
+    ZMQ_ERR(zmq_close(PEER(channel, n)->control));
   }
   /* close RO source, "fast forward" to EOF if needed */
   else
   {
-    /*
-     * TODO(d'b): this is a temporary solution. complete solution can be
-     * implemented when daemon/proxy will be able to terminate zerovm by
-     * request for instance when cluster is already done except "sending"
-     * reserve node (reported as useless by "receiving" node(s))
-     */
     if(CH_CONN(channel, n)->pos < channel->getpos)
       channel->eof = 0;
 
-    /* read until EOF (to avoid hanging sending session) */
-    for(; channel->eof == 0; FetchMessage(channel, n))
+    /*
+     * stop the writer and read until EOF (to avoid hanging sending
+     * session). only the data already sent is read
+     */
+    if(channel->eof == 0) Cancel(channel, n);
+    for(; channel->eof == 0; ZmqFetchMessage(channel, n, 0))
     {
       if(n == 0) channel->getpos += channel->bufend;
       CH_CONN(channel, n)->pos += channel->bufend;
@@ -345,6 +769,25 @@ void PrefetchChannelDtor(struct ChannelDesc *channel, int n)
   /* close source */
   ZMQ_ERR(zmq_close(CH_HANDLE(channel, n)));
   CH_HANDLE(channel, n) = NULL;
+  g_free(PEER(channel, n)->url);
+  g_free(CH_BACKUP(channel, n));
+  CH_BACKUP(channel, n) = NULL;
   ZLOGS(LOG_DEBUG, "%s closed", url);
   g_free(url);
 }
+
+struct Transport const kZmqTransport = {
+  "zmq",
+  PROTO_BIT(TCP),
+  ZmqNetCtor,
+  ZmqNetDtor,
+  ZmqChannelCtor,
+  ZmqChannelDtor,
+  NULL,
+  ZmqMessageData,
+  ZmqFreeMessage,
+  ZmqFetchMessage,
+  ZmqSendData,
+  ZmqBroadcast,
+  ZmqPoll,
+};
@@ -15,9 +15,11 @@
  */
 #include <assert.h>
 #include "src/channels/preload.h"
+#include "src/channels/compress.h"
 
 #define CHANNEL_RIGHTS S_IRUSR | S_IWUSR
 #define DEV_NULL "/dev/null"
+#define PREALLOC_EXTENT 0x100000 /* the least space reserved ahead of writes */
 
 static int disable_preallocation = 0;
 
@@ -62,7 +64,8 @@ int PreloadChannelDtor(struct ChannelDesc *channel, int n)
   handle = GPOINTER_TO_INT(CH_HANDLE(channel, n));
   if(channel->limits[PutSizeLimit] && channel->limits[PutsLimit]
      && CH_PROTO(channel, n) == ProtoRegular)
-    code = ftruncate(handle, channel->size);
+    code = ftruncate(handle, channel->codec == NULL ? channel->size
+        : ((struct Codec*)channel->codec)->offset);
 
   ZLOGS(LOG_DEBUG,
       "%s closed with getsize = %ld, putsize = %ld", channel->alias,
@@ -83,14 +86,54 @@ int PreloadChannelDtor(struct ChannelDesc *channel, int n)
 /* preallocate channel space if not disabled with "-P" */
 static void PreallocateChannel(const struct ChannelDesc *channel, int n)
 {
-  int code;
+  int code = 0;
   int handle = GPOINTER_TO_INT(CH_HANDLE(channel, n));
 
   if(disable_preallocation) return;
-  code = ftruncate(handle, channel->limits[PutSizeLimit]);
+  switch(channel->options[OptPrealloc])
+  {
+    case PreallocGrow: /* see PreloadGrow() */
+    case PreallocNone:
+      break;
+    case PreallocLimit:
+      code = fallocate(handle, FALLOC_FL_KEEP_SIZE,
+          0, channel->limits[PutSizeLimit]);
+      if(code == -1 && errno == EOPNOTSUPP) code = 0;
+      break;
+    case PreallocTruncate:
+      code = ftruncate(handle, channel->limits[PutSizeLimit]);
+      break;
+    default:
+      ZLOGFAIL(1, EFAULT, "%s has invalid preallocation %ld",
+          channel->alias, channel->options[OptPrealloc]);
+      break;
+  }
   ZLOGFAIL(code == -1, errno, "cannot preallocate %s", channel->alias);
 }
 
+void PreloadGrow(struct ChannelDesc *channel, int n, int64_t end)
+{
+  struct File *f = CH_FILE(channel, n);
+  int64_t size;
+
+  if(end <= f->reserved) return;
+  if(disable_preallocation || channel->options[OptPrealloc] != PreallocGrow)
+    return;
+
+  /* double the reserved space. on failure stop reserving */
+  size = MAX(end, f->reserved + PREALLOC_EXTENT);
+  size = MAX(size, f->reserved * 2);
+  size = MIN(size, MAX(end, channel->limits[PutSizeLimit]));
+  if(fallocate(GPOINTER_TO_INT(f->handle), FALLOC_FL_KEEP_SIZE,
+      f->reserved, size - f->reserved) != 0)
+  {
+    ZLOGS(LOG_DEBUG, "%s preallocation stopped: %s",
+        channel->alias, strerror(errno));
+    size = INT64_MAX;
+  }
+  f->reserved = size;
+}
+
 /* preload given character/FIFO device to channel */
 static void CharacterChannel(struct ChannelDesc* channel, int n)
 {
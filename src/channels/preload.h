@@ -31,6 +31,9 @@ void PreloadAllocationDisable();
  */
 void PreloadChannelCtor(struct ChannelDesc* channel, int n);
 
+/* reserve the space of the regular file source to write up to "end" */
+void PreloadGrow(struct ChannelDesc *channel, int n, int64_t end);
+
 /* (adjust and) close file associated with the channel */
 int PreloadChannelDtor(struct ChannelDesc* channel, int n);
 
@@ -248,24 +248,30 @@ void AppLoadFile(struct Gio *gp, struct NaClApp *nap)
 }
 #undef DUMP
 
-NORETURN void CreateSession(struct NaClApp *nap)
+/* set an empty user stack and construct "nacl_user" */
+static void UserContextCtor(struct NaClApp *nap)
 {
   uintptr_t stack_ptr;
 
-  assert(nap != NULL);
-
   /* set up user stack */
-  stack_ptr = nap->mem_start + ((uintptr_t)1U << nap->addr_bits);
+  stack_ptr = nap->mem_start + StackEnd(nap);
   stack_ptr -= STACK_USER_DATA_SIZE;
   memset((void*)stack_ptr, 0, STACK_USER_DATA_SIZE);
   ((uint32_t*)stack_ptr)[4] = 1;
   ((uint32_t*)stack_ptr)[5] = 0xfffffff0;
 
+  ThreadContextCtor(nacl_user, nap, nap->initial_entry_pt, stack_ptr);
+}
+
+NORETURN void CreateSession(struct NaClApp *nap)
+{
+  assert(nap != NULL);
+
   /*
    * construct "nacl_user" and "nacl_sys" globals
    * note: nacl_sys->prog_ctr meaningless but should not be 0
    */
-  ThreadContextCtor(nacl_user, nap, nap->initial_entry_pt, stack_ptr);
+  UserContextCtor(nap);
   ThreadContextCtor(nacl_sys, nap, 1, GetStackPtr());
 
   /* pass control to the user side */
@@ -273,3 +279,14 @@ NORETURN void CreateSession(struct NaClApp *nap)
   ContextSwitch(nacl_user);
   ZLOGFAIL(1, EFAULT, "the unreachable has been reached");
 }
+
+NORETURN void RestartSession(struct NaClApp *nap)
+{
+  assert(nap != NULL);
+
+  /* "nacl_sys" is kept: the trap stack starts from the same place */
+  UserContextCtor(nap);
+  ZLOGS(LOG_DEBUG, "SESSION %d RESTARTED", nap->manifest->node);
+  ContextSwitch(nacl_user);
+  ZLOGFAIL(1, EFAULT, "the unreachable has been reached");
+}
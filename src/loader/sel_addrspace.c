@@ -123,9 +123,9 @@ void AllocAddrSpace(struct NaClApp *nap)
 
   hole_start = ROUNDUP_64K(nap->data_end);
 
-  ZLOGFAIL(nap->stack_size >= ((uintptr_t) 1U) << nap->addr_bits,
+  ZLOGFAIL(nap->stack_size >= StackEnd(nap),
       EFAULT, "AllocAddrSpace: stack too large!");
-  stack_start = (((uintptr_t) 1U) << nap->addr_bits) - nap->stack_size;
+  stack_start = StackEnd(nap) - nap->stack_size;
   stack_start = ROUNDUP_64K(stack_start);
 
   ZLOGFAIL(stack_start < hole_start, EFAULT,
@@ -247,8 +247,7 @@ void MemoryProtection(struct NaClApp *nap)
 
   /* stack is read/write but not execute */
   region_size = nap->stack_size;
-  start_addr = NaClUserToSys(nap,
-      ROUNDUP_64K(((uintptr_t) 1U << nap->addr_bits) - nap->stack_size));
+  start_addr = NaClUserToSys(nap, ROUNDUP_64K(StackEnd(nap) - nap->stack_size));
   ZLOGS(LOG_INSANE, "RW stack region start 0x%08x, size 0x%08lx, end 0x%08x",
           start_addr, region_size, start_addr + region_size);
 
@@ -72,6 +72,19 @@ static INLINE uintptr_t NaClSysToUser(struct NaClApp *nap, uintptr_t sysaddr)
   return sysaddr - nap->mem_start;
 }
 
+/*
+ * user address of the stack end. the stacks up to the default size are
+ * placed at the top of the user space (above the user manifest, the rest
+ * of the default stack area is a guard), the bigger ones are placed right
+ * below the user manifest area
+ */
+static INLINE uintptr_t StackEnd(struct NaClApp *nap)
+{
+  return nap->stack_size <= NACL_DEFAULT_STACK_MAX
+      ? (uintptr_t)1U << nap->addr_bits
+      : USER_MANIFEST_TOP - USER_MANIFEST_LIMIT;
+}
+
 static INLINE uintptr_t NaClEndOfStaticText(struct NaClApp *nap)
 {
   return nap->static_text_end;
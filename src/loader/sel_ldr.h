@@ -41,6 +41,8 @@
 
 /* from sel_ldr_x86.h */
 #define NACL_DEFAULT_STACK_MAX (16 << 20) /* untrusted stack */
+#define USER_MANIFEST_TOP (FOURGIG - NACL_DEFAULT_STACK_MAX) /* MANIFEST in zvm.h */
+#define USER_MANIFEST_LIMIT (2 << 20) /* user manifest under the big stack */
 #define NACL_MAX_ADDR_BITS (32)
 #define NACL_HALT_OPCODE   0xf4
 #define NACL_HALT_LEN      1 /* length of halt instruction */
@@ -200,6 +202,12 @@ void PrintAppDetails(struct NaClApp *nap, int verbosity);
  */
 void CreateSession(struct NaClApp *nap);
 
+/*
+ * start the user program from the entry point again with an empty user
+ * stack. the user memory should be reset by the caller (see setup.h)
+ */
+void RestartSession(struct NaClApp *nap);
+
 /*
  * Install syscall trampolines at all possible well-formed entry points
  * within the trampoline pages.  Many of these syscalls will correspond
@@ -16,6 +16,8 @@
 
 #include <assert.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include "src/loader/sel_ldr.h"
 #include "src/main/accounting.h"
 #include "src/main/manifest.h"
@@ -24,6 +26,8 @@
 
 static int64_t network_stats[LimitsNumber] = {0};
 static int64_t local_stats[LimitsNumber] = {0};
+static int64_t memory_stats[MemStatsNumber] = {0};
+static int64_t memory_base[MemStatsNumber] = {0};
 static float user_time = 0;
 static float sys_time = 0;
 
@@ -51,6 +55,86 @@ void CountPut(struct Connection *c, int size)
   CountBytes(c, size, PutsLimit);
 }
 
+/* bytes of the user heap pages resident in memory */
+static int64_t TouchedHeap()
+{
+  struct MemBlock *heap;
+  unsigned char *pages;
+  int64_t result = 0;
+  size_t number;
+  size_t i;
+
+  if(gnap == NULL) return 0;
+  heap = &gnap->mem_map[HeapIdx];
+  if(heap->size == 0) return 0;
+
+  number = (heap->size + NACL_PAGESIZE - 1) / NACL_PAGESIZE;
+  pages = g_malloc(number);
+  if(mincore((void*)heap->start, heap->size, pages) == 0)
+    for(i = 0; i < number; ++i)
+      result += pages[i] & 1;
+
+  g_free(pages);
+  return result * NACL_PAGESIZE;
+}
+
+/*
+ * peak rss (kilobytes) since the last reset of the high water mark.
+ * ru_maxrss cannot be reset, so read "VmHWM" and fall back to it
+ */
+static int64_t PeakRSS(int64_t maxrss)
+{
+  char line[BIG_ENOUGH_STRING];
+  int64_t result = maxrss;
+  FILE *f = fopen("/proc/self/status", "r");
+
+  if(f == NULL) return result;
+  while(fgets(line, sizeof line, f) != NULL)
+    if(sscanf(line, "VmHWM: %ld", &result) == 1) break;
+
+  fclose(f);
+  return result;
+}
+
+/* update memory statistics. faults are counted from the session start */
+static void UpdateMemory()
+{
+  struct rusage usage;
+
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    memory_stats[MemPeakRSS] = PeakRSS(usage.ru_maxrss);
+    memory_stats[MemMinorFaults] = usage.ru_minflt - memory_base[MemMinorFaults];
+    memory_stats[MemMajorFaults] = usage.ru_majflt - memory_base[MemMajorFaults];
+  }
+  memory_stats[MemTouchedHeap] = TouchedHeap();
+}
+
+/*
+ * start the memory statistics of a new session: remember the process
+ * faults and reset the peak rss to the current rss (linux 4.0+)
+ */
+static void ResetMemoryStats()
+{
+  struct rusage usage;
+  FILE *f;
+  int code;
+
+  memset(memory_stats, 0, sizeof memory_stats);
+  memset(memory_base, 0, sizeof memory_base);
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    memory_base[MemMinorFaults] = usage.ru_minflt;
+    memory_base[MemMajorFaults] = usage.ru_majflt;
+  }
+
+  f = fopen("/proc/self/clear_refs", "w");
+  if(f == NULL) return;
+  code = fputs("5", f);
+  code |= fclose(f);
+  ZLOGIF(code < 0, "cannot reset the peak rss");
+}
+
 /* get I/O and CPU time */
 static void SystemAccounting()
 {
@@ -94,11 +178,24 @@ char *FastAccounting()
 char *FinalAccounting()
 {
   SystemAccounting();
+  UpdateMemory();
   return Accounting(0);
 }
 
+void GetAccounting(struct Accounting *acc)
+{
+  assert(acc != NULL);
+
+  acc->sys_time = sys_time;
+  acc->user_time = user_time;
+  memcpy(acc->local, local_stats, sizeof local_stats);
+  memcpy(acc->network, network_stats, sizeof network_stats);
+  memcpy(acc->memory, memory_stats, sizeof memory_stats);
+}
+
 void ResetAccounting()
 {
   memset(network_stats, 0, sizeof network_stats);
   memset(local_stats, 0, sizeof network_stats);
+  ResetMemoryStats();
 }
@@ -21,6 +21,24 @@
 
 #include "src/channels/channel.h"
 
+/* memory statistics */
+enum MemoryStats {
+  MemPeakRSS, /* kilobytes */
+  MemMinorFaults,
+  MemMajorFaults,
+  MemTouchedHeap, /* bytes of the resident heap pages */
+  MemStatsNumber
+};
+
+/* raw session statistics (for the structured reports) */
+struct Accounting {
+  float sys_time; /* seconds */
+  float user_time; /* seconds */
+  int64_t local[LimitsNumber];
+  int64_t network[LimitsNumber];
+  int64_t memory[MemStatsNumber];
+};
+
 /* update get statistics */
 void CountGet(struct Connection *c, int size);
 
@@ -40,7 +58,13 @@ char *FastAccounting();
  */
 char *FinalAccounting();
 
-/* reset accounting internals */
+/*
+ * copy the raw statistics collected so far. cpu times are only
+ * available after FinalAccounting() call
+ */
+void GetAccounting(struct Accounting *acc);
+
+/* reset accounting internals and start the memory statistics anew */
 void ResetAccounting();
 
 #endif /* ACCOUNTING_H_ */
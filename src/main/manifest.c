@@ -49,6 +49,20 @@
   XARRAY(PROTOCOLS)
 #undef X
 
+#define X(a, d) #a,
+  XARRAY(CHANNEL_OPTIONS)
+#undef X
+
+#define X(a, d) #a,
+  XARRAY(SESSION_OPTIONS)
+#undef X
+
+#define XDEFAULT(a) static int64_t DEFAULT_##a[] = {a};
+#define X(a, d) d,
+  XDEFAULT(CHANNEL_OPTIONS)
+  XDEFAULT(SESSION_OPTIONS)
+#undef X
+
 /* key/value tokens */
 typedef enum {
   Key,
@@ -84,6 +98,21 @@ typedef enum {
   ChannelTokensNumber
 } ChannelTokens;
 
+/* channel option tokens */
+typedef enum {
+  OptionAlias,
+  OptionName,
+  OptionValue,
+  OptionTokensNumber
+} OptionTokens;
+
+/* session option tokens */
+typedef enum {
+  SessionName,
+  SessionValue,
+  SessionTokensNumber
+} SessionTokens;
+
 /* (x-macro): manifest keywords (name, obligatory, singleton) */
 #define KEYWORDS \
   X(Channel, 1, 0) \
@@ -94,7 +123,9 @@ typedef enum {
   X(NameServer, 0, 1) \
   X(Node, 0, 1) \
   X(Job, 0, 1) \
-  X(Etag, 0, 1)
+  X(Etag, 0, 1) \
+  X(Option, 0, 0) \
+  X(Session, 0, 0)
 
 /* (x-macro): manifest enumeration, array and statistics */
 #define XENUM(a) enum ENUM_##a {a};
@@ -328,12 +359,77 @@ static void Channel(struct Manifest *manifest, char *value)
         "negative limits for %s", channel->alias);
   }
 
+  /* options can be changed later with "Option" keyword */
+  memcpy(channel->options, DEFAULT_CHANNEL_OPTIONS, sizeof channel->options);
+
   /* append a new channel */
   g_ptr_array_add(manifest->channels, channel);
   g_strfreev(names);
   g_strfreev(tokens);
 }
 
+/* set the option of already declared channel */
+static void Option(struct Manifest *manifest, char *value)
+{
+  char **tokens;
+  char *name;
+  int i;
+  struct ChannelDesc *channel = NULL;
+
+  tokens = g_strsplit(value, VALUE_DELIMITER, OptionTokensNumber);
+  MFTFAIL(tokens[OptionTokensNumber] != NULL || tokens[OptionValue] == NULL,
+      EFAULT, "invalid option tokens number");
+
+  /* find the channel */
+  name = g_strstrip(tokens[OptionAlias]);
+  for(i = 0; i < manifest->channels->len; ++i)
+    if(g_strcmp0(CH_CH(manifest, i)->alias, name) == 0)
+      channel = CH_CH(manifest, i);
+  MFTFAIL(channel == NULL, EFAULT, "option for undeclared channel %s", name);
+
+  /* find and set the option */
+  name = g_strstrip(tokens[OptionName]);
+  for(i = 0; i < XSIZE(CHANNEL_OPTIONS); ++i)
+    if(g_strcmp0(XSTR(CHANNEL_OPTIONS, i), name) == 0) break;
+  MFTFAIL(i == XSIZE(CHANNEL_OPTIONS), EFAULT, "unknown channel option %s", name);
+
+  channel->options[i] = ToInt(tokens[OptionValue]);
+  MFTFAIL(channel->options[i] < 0, EFAULT,
+      "negative option %s for %s", name, channel->alias);
+  g_strfreev(tokens);
+}
+
+/* set the session option */
+static void Session(struct Manifest *manifest, char *value)
+{
+  char **tokens;
+  char *name;
+  int i;
+
+  tokens = g_strsplit(value, VALUE_DELIMITER, SessionTokensNumber);
+  MFTFAIL(tokens[SessionTokensNumber] != NULL || tokens[SessionValue] == NULL,
+      EFAULT, "invalid session tokens number");
+
+  /* find and set the option */
+  name = g_strstrip(tokens[SessionName]);
+  for(i = 0; i < XSIZE(SESSION_OPTIONS); ++i)
+    if(g_strcmp0(XSTR(SESSION_OPTIONS, i), name) == 0) break;
+  MFTFAIL(i == XSIZE(SESSION_OPTIONS), EFAULT, "unknown session option %s", name);
+
+  /* the cpu list is kept as is (checked when the session is bound) */
+  if(i == SessionCpuSet)
+  {
+    g_free(manifest->cpus);
+    manifest->cpus = g_strdup(g_strstrip(tokens[SessionValue]));
+    g_strfreev(tokens);
+    return;
+  }
+
+  manifest->options[i] = ToInt(tokens[SessionValue]);
+  MFTFAIL(manifest->options[i] < 0, EFAULT, "negative session option %s", name);
+  g_strfreev(tokens);
+}
+
 /*
  * check if obligatory keywords appeared and check if the fields
  * which should appear only once did so
@@ -356,8 +452,9 @@ struct Manifest *ManifestTextCtor(char *text)
   char **lines;
   int i;
 
-  /* initialize channels */
+  /* initialize channels and session options */
   manifest->channels = g_ptr_array_new();
+  memcpy(manifest->options, DEFAULT_SESSION_OPTIONS, sizeof manifest->options);
 
   /* extract all lines */
   lines = g_strsplit(text, LINE_DELIMITER, MANIFEST_LINES_LIMIT);
@@ -424,6 +521,7 @@ void ManifestDtor(struct Manifest *manifest)
 
   /* other */
   g_free(manifest->etag);
+  g_free(manifest->cpus);
   TagDtor(manifest->mem_tag);
   g_free(manifest->name_server);
   g_free(manifest->program);
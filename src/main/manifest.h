@@ -38,6 +38,9 @@ EXTERN_C_BEGIN
     X(INPROC) \
     X(PGM) \
     X(EPGM) \
+    X(UDT) \
+    X(NTCP) \
+    X(SHM) \
     X(Regular) \
     X(Directory) \
     X(Character) \
@@ -52,6 +55,43 @@ EXTERN_C_BEGIN
   XENUM(PROTOCOLS)
 #undef X
 
+/*
+ * (x-macro): channel options (name, default value). options are set with
+ * "Option" keyword after the channel declaration (see manifest.txt)
+ */
+#define CHANNEL_OPTIONS \
+    X(MsgSize, 0x10000) \
+    X(SndHwm, 64) \
+    X(RcvHwm, 64) \
+    X(SndBuf, 0) \
+    X(RcvBuf, 0) \
+    X(Batch, 0) \
+    X(Compress, 0) \
+    X(CompressLevel, 0) \
+    X(Mode, 0) \
+    X(Prealloc, 0)
+
+#define X(a, d) Opt ## a,
+  enum ChannelOptions {CHANNEL_OPTIONS ChannelOptionsNumber};
+#undef X
+
+/*
+ * (x-macro): session options (name, default value). options are set with
+ * "Session" keyword (see manifest.txt)
+ */
+#define SESSION_OPTIONS \
+    X(HugePages, 0) \
+    X(NumaNodes, 0) \
+    X(CpuSet, 0) \
+    X(LazyHeap, 0) \
+    X(ResetMemory, 0) \
+    X(ForkPrefault, 0) \
+    X(StackSize, 0)
+
+#define X(a, d) Session ## a,
+  enum SessionOptions {SESSION_OPTIONS SessionOptionsNumber};
+#undef X
+
 /*
  * short "flags" description:
  * 0:    id/ip. 0 means id specified by "Channel" field, 1 - ip4
@@ -66,7 +106,7 @@ struct Connection {
   uint8_t flags;
   uint16_t port;
   uint32_t host;
-  void *backup; /* for udt it is stored original handle */
+  void *backup; /* udt: original handle, 0mq: batch */
 };
 
 /* local channel description */
@@ -76,6 +116,7 @@ struct File {
   int64_t pos; /* position */
   uint8_t flags;
   char *name;
+  int64_t reserved; /* space preallocated ahead of writes */
 };
 
 /* channel structure */
@@ -86,10 +127,14 @@ struct ChannelDesc {
   enum ChannelType type; /* type of access sequential/random */
   void *tag; /* tag context */
   int64_t limits[LimitsNumber];
+  int64_t options[ChannelOptionsNumber]; /* see CHANNEL_OPTIONS */
   int8_t eof;
 
   /* constructor initialize it */
   void *msg; /* network message container */
+  void *codec; /* compression state or NULL */
+  void *stripe; /* striping state or NULL */
+  void *merge; /* merging state or NULL */
   int64_t size; /* file size (or 0) */
   int64_t getpos; /* channel read position */
   int64_t putpos; /* channel write position */
@@ -109,6 +154,8 @@ struct Manifest {
   void *mem_tag; /* tag context */
   struct Connection *name_server;
   GPtrArray *channels; /* all elements are (ChannelDesc*) */
+  int64_t options[SessionOptionsNumber]; /* see SESSION_OPTIONS */
+  char *cpus; /* "CpuSet" cpu list or NULL */
 };
 
 /* de-serialize manifest from the given file */
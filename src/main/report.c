@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include "src/main/report.h"
 #include "src/platform/signal.h"
 #include "src/main/accounting.h"
@@ -24,6 +25,8 @@
 #include "src/channels/channel.h"
 
 #define QUANT MICRO_PER_SEC
+#define REPORT_PREFIX_SIZE 8 /* "0x%06x" report size for the socket mode */
+#define PHASES_LIMIT 16 /* startup phases to report */
 
 #ifdef DEBUG
 #define REPORT_VALIDATOR "validator state = "
@@ -59,17 +62,53 @@ static char *zvm_state = NULL;
 static GString *digests = NULL; /* cumulative etags */
 static GString *cmd = NULL;
 static int report_handle = STDOUT_FILENO;
+static int report_format = TextReport;
+static int64_t start_time = 0; /* session start (monotonic, microseconds) */
+static GPtrArray *channels = NULL; /* (struct ChannelReport*) */
+static int64_t phase_mark = 0; /* end of the previous startup phase */
+static int phases_number = 0;
+static int64_t startup_rss = 0; /* peak rss by the last phase (kilobytes) */
+static int64_t huge_pages = -1; /* user memory backed by huge pages */
+static uint64_t numa_nodes = 0; /* numa nodes the session is bound to */
+static int fast_exit = 0;
+
+/* startup phase duration */
+static struct {
+  const char *name;
+  double time;
+} phases[PHASES_LIMIT];
+
+/* channel summary collected on the channel destruction */
+struct ChannelReport {
+  char *alias;
+  char digest[TAG_DIGEST_SIZE + 1]; /* empty string if etag disabled */
+  int64_t counters[LimitsNumber];
+  int64_t size;
+  int eof;
+};
 
 void SetReportHandle(int handle)
 {
   report_handle = handle;
 }
 
+void ReportFastExit()
+{
+  fast_exit = 1;
+}
+
 void ReportMode(int mode)
 {
   report_mode = mode;
 }
 
+void ReportFormat(int format)
+{
+  ZLOGFAIL(format < TextReport || format > BinaryReport, EINVAL,
+      "invalid report format %d", format);
+  report_format = format;
+}
+
 void SetExitState(const char *state)
 {
   g_free(zvm_state);
@@ -140,6 +179,50 @@ void ReportTag(char *name, void *tag)
   g_string_append_printf(digests, "%s %s ", name, digest);
 }
 
+static void ChannelReportFree(struct ChannelReport *info)
+{
+  g_free(info->alias);
+  g_free(info);
+}
+
+void ReportNumaNodes(uint64_t nodes)
+{
+  numa_nodes = nodes;
+}
+
+void ReportPhase(const char *name)
+{
+  int64_t now = g_get_monotonic_time();
+  struct rusage usage;
+
+  assert(name != NULL);
+  if(phases_number == PHASES_LIMIT) return;
+
+  phases[phases_number].name = name;
+  phases[phases_number++].time = (now - phase_mark) / (double)MICRO_PER_SEC;
+  phase_mark = now;
+
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+    startup_rss = usage.ru_maxrss;
+}
+
+void ReportChannel(struct ChannelDesc *channel)
+{
+  struct ChannelReport *info;
+
+  assert(channel != NULL);
+
+  info = g_malloc0(sizeof *info);
+  info->alias = g_strdup(channel->alias);
+  if(channel->tag != NULL) TagDigest(channel->tag, info->digest);
+  memcpy(info->counters, channel->counters, sizeof info->counters);
+  info->size = channel->size;
+  info->eof = channel->eof;
+  g_ptr_array_add(channels, info);
+
+  ReportTag(channel->alias, channel->tag);
+}
+
 /* calculate user memory tag, and return pointer to it */
 static void *GetMemoryDigest(struct NaClApp *nap)
 {
@@ -164,14 +247,28 @@ static void *GetMemoryDigest(struct NaClApp *nap)
 void ReportCtor()
 {
   digests = g_string_sized_new(BIG_ENOUGH_STRING);
+  channels = g_ptr_array_new_with_free_func((GDestroyNotify)ChannelReportFree);
+  start_time = g_get_monotonic_time();
+  phase_mark = start_time;
+}
+
+void ReportReset()
+{
+  g_string_truncate(digests, 0);
+  g_ptr_array_set_size(channels, 0);
+  g_free(zvm_state);
+  zvm_state = NULL;
+  user_code = 0;
+  zvm_code = 0;
+  phases_number = 0;
+  start_time = g_get_monotonic_time();
 }
 
 /* output report */
 /* TODO(d'b): rework "-t" and update the function */
-static void OutputReport(char *r)
+static void OutputReport(char *r, int size)
 {
   char *p = NULL;
-  int size = strlen(r);
 
 #define REPORT(p) ZLOGIF(write(report_handle, p, size) != size, \
   "report write error %d: %s", errno, strerror(errno))
@@ -179,8 +276,10 @@ static void OutputReport(char *r)
   switch(report_mode)
   {
     case 3: /* unix socket */
-      p = g_strdup_printf("0x%06x%s", size, r);
-      size = strlen(p);
+      p = g_malloc(size + REPORT_PREFIX_SIZE + 1);
+      g_snprintf(p, REPORT_PREFIX_SIZE + 1, "0x%06x", size);
+      memcpy(p + REPORT_PREFIX_SIZE, r, size);
+      size += REPORT_PREFIX_SIZE;
       REPORT(p);
       g_free(p);
       break;
@@ -218,30 +317,233 @@ void FastReport()
   /* create and output report */
   acc = FastAccounting();
   r = g_strdup_printf("%s%s%s", REPORT_ACCOUNTING, acc, eol);
-  OutputReport(r);
+  OutputReport(r, strlen(r));
 
   g_free(acc);
   g_free(r);
 }
 
-/* part of report class dtor */
+/* append quoted and escaped json string */
+static void JsonString(GString *r, const char *s)
+{
+  g_string_append_c(r, '"');
+  for(; *s != '\0'; ++s)
+  {
+    if(*s == '"' || *s == '\\')
+      g_string_append_printf(r, "\\%c", *s);
+    else if((unsigned char)*s < 0x20)
+      g_string_append_printf(r, "\\u%04x", *s);
+    else
+      g_string_append_c(r, *s);
+  }
+  g_string_append_c(r, '"');
+}
+
+/* append json object with i/o counters */
+static void JsonCounters(GString *r, const char *name, int64_t *c)
+{
+  g_string_append_printf(r, "\"%s\":{\"gets\":%ld,\"get_size\":%ld,"
+      "\"puts\":%ld,\"put_size\":%ld}", name, c[GetsLimit],
+      c[GetSizeLimit], c[PutsLimit], c[PutSizeLimit]);
+}
+
+/* append binary report record */
+static void Record(GString *r, int type, const void *value, uint32_t size)
+{
+  uint8_t t = type;
+
+  g_string_append_len(r, (const char*)&t, sizeof t);
+  g_string_append_len(r, (const char*)&size, sizeof size);
+  g_string_append_len(r, value, size);
+}
+
+static void RecordInt(GString *r, int type, int64_t value)
+{
+  Record(r, type, &value, sizeof value);
+}
+
+static void RecordTime(GString *r, int type, double value)
+{
+  Record(r, type, &value, sizeof value);
+}
+
+static void RecordString(GString *r, int type, const char *value)
+{
+  Record(r, type, value, strlen(value));
+}
+
+/*
+ * user memory backed by huge pages in bytes (from /proc/self/smaps)
+ * or -1 if huge pages are not asked
+ */
+static int64_t HugePagesCoverage(struct NaClApp *nap)
+{
+  char line[BIG_ENOUGH_STRING];
+  uintptr_t start;
+  uintptr_t end;
+  int64_t size;
+  int64_t result = 0;
+  int inside = 0;
+  FILE *f;
+
+  if(nap == NULL || nap->manifest == NULL) return -1;
+  if(nap->manifest->options[SessionHugePages] == 0) return -1;
+  f = fopen("/proc/self/smaps", "r");
+  if(f == NULL) return -1;
+
+  /* sum up huge pages of the regions inside the user space */
+  while(fgets(line, sizeof line, f) != NULL)
+    if(sscanf(line, "%lx-%lx ", &start, &end) == 2)
+      inside = start < nap->mem_start + FOURGIG && end > nap->mem_start;
+    else if(inside && sscanf(line, "AnonHugePages: %ld kB", &size) == 1)
+      result += size * 1024;
+
+  fclose(f);
+  return result;
+}
+
+/* json report. "memory" is the memory etag or NULL */
+static void ReportJson(GString *r, struct Accounting *acc, char *memory)
+{
+  int i;
+
+  g_string_append_printf(r, "{\"validator\":%d,\"daemon\":%d,"
+      "\"user_code\":%d,\"exit_code\":%d,\"state\":",
+      validation_state, daemon_state, user_code, zvm_code);
+  JsonString(r, zvm_state);
+  g_string_append_printf(r, ",\"time\":{\"sys\":%.2f,\"user\":%.2f,"
+      "\"wall\":%.6f},", acc->sys_time, acc->user_time,
+      (g_get_monotonic_time() - start_time) / (double)MICRO_PER_SEC);
+  JsonCounters(r, "local", acc->local);
+  g_string_append_c(r, ',');
+  JsonCounters(r, "network", acc->network);
+  g_string_append_printf(r, ",\"memory\":{\"peak_rss\":%ld,"
+      "\"minor_faults\":%ld,\"major_faults\":%ld,\"touched_heap\":%ld}",
+      acc->memory[MemPeakRSS], acc->memory[MemMinorFaults],
+      acc->memory[MemMajorFaults], acc->memory[MemTouchedHeap]);
+
+  if(memory != NULL)
+    g_string_append_printf(r, ",\"memory_etag\":\"%s\"", memory);
+
+  /* startup phases */
+  g_string_append(r, ",\"startup\":{");
+  for(i = 0; i < phases_number; ++i)
+  {
+    JsonString(r, phases[i].name);
+    g_string_append_printf(r, ":%.6f,", phases[i].time);
+  }
+  g_string_append_printf(r, "\"peak_rss\":%ld}", startup_rss);
+  if(huge_pages >= 0)
+    g_string_append_printf(r, ",\"huge_pages\":%ld", huge_pages);
+  if(numa_nodes != 0)
+  {
+    char *separator = "";
+
+    g_string_append(r, ",\"numa_nodes\":[");
+    for(i = 0; i < 64; ++i)
+      if(numa_nodes >> i & 1)
+      {
+        g_string_append_printf(r, "%s%d", separator, i);
+        separator = ",";
+      }
+    g_string_append_c(r, ']');
+  }
+
+  /* channels */
+  g_string_append(r, ",\"channels\":[");
+  for(i = 0; i < channels->len; ++i)
+  {
+    struct ChannelReport *info = g_ptr_array_index(channels, i);
+
+    g_string_append(r, i == 0 ? "{\"alias\":" : ",{\"alias\":");
+    JsonString(r, info->alias);
+    if(*info->digest != '\0')
+      g_string_append_printf(r, ",\"etag\":\"%s\"", info->digest);
+    g_string_append_c(r, ',');
+    JsonCounters(r, "counters", info->counters);
+    g_string_append_printf(r, ",\"size\":%ld,\"eof\":%d}",
+        info->size, info->eof);
+  }
+  g_string_append_c(r, ']');
+
+#ifdef DEBUG
+  g_string_append(r, ",\"command\":");
+  JsonString(r, cmd->str);
+#endif
+  g_string_append(r, "}\n");
+}
+
+/* binary (type-length-value) report. "memory" is the memory etag or NULL */
+static void ReportBinary(GString *r, struct Accounting *acc, char *memory)
+{
+  int i;
+
+  RecordInt(r, RecordValidator, validation_state);
+  RecordInt(r, RecordDaemon, daemon_state);
+  RecordInt(r, RecordUserCode, user_code);
+  RecordInt(r, RecordExitCode, zvm_code);
+  RecordString(r, RecordState, zvm_state);
+  RecordTime(r, RecordSysTime, acc->sys_time);
+  RecordTime(r, RecordUserTime, acc->user_time);
+  RecordTime(r, RecordWallTime,
+      (g_get_monotonic_time() - start_time) / (double)MICRO_PER_SEC);
+  Record(r, RecordLocalIO, acc->local, sizeof acc->local);
+  Record(r, RecordNetworkIO, acc->network, sizeof acc->network);
+  Record(r, RecordMemory, acc->memory, sizeof acc->memory);
+  if(memory != NULL) RecordString(r, RecordMemoryEtag, memory);
+
+  /* startup phases: nested records */
+  if(phases_number > 0)
+  {
+    GString *s = g_string_sized_new(BIG_ENOUGH_STRING);
+
+    for(i = 0; i < phases_number; ++i)
+    {
+      GString *p = g_string_new_len((const char*)&phases[i].time,
+          sizeof phases[i].time);
+
+      g_string_append(p, phases[i].name);
+      Record(s, RecordPhase, p->str, p->len);
+      g_string_free(p, TRUE);
+    }
+    RecordInt(s, RecordPeakRSS, startup_rss);
+    Record(r, RecordStartup, s->str, s->len);
+    g_string_free(s, TRUE);
+  }
+  if(huge_pages >= 0) RecordInt(r, RecordHugePages, huge_pages);
+  if(numa_nodes != 0) RecordInt(r, RecordNumaNodes, numa_nodes);
+
+  /* channels: nested records */
+  for(i = 0; i < channels->len; ++i)
+  {
+    struct ChannelReport *info = g_ptr_array_index(channels, i);
+    GString *c = g_string_sized_new(BIG_ENOUGH_STRING);
+
+    RecordString(c, RecordAlias, info->alias);
+    if(*info->digest != '\0') RecordString(c, RecordEtag, info->digest);
+    Record(c, RecordCounters, info->counters, sizeof info->counters);
+    RecordInt(c, RecordSize, info->size);
+    RecordInt(c, RecordEof, info->eof);
+    Record(r, RecordChannel, c->str, c->len);
+    g_string_free(c, TRUE);
+  }
+
+#ifdef DEBUG
+  RecordString(r, RecordCommand, cmd->str);
+#endif
+}
+
+/* classic (positional) text report */
 #define REPORT g_string_append_printf
-void Report(struct NaClApp *nap)
+static void ReportText(GString *r, char *acc)
 {
-  GString *r = g_string_sized_new(BIG_ENOUGH_STRING);
   char *eol = report_mode == 1 ? "; " : "\n";
-  char *acc = FinalAccounting();
 
   /* report validator state and user return code */
   REPORT(r, "%s%d%s", REPORT_VALIDATOR, validation_state, eol);
   REPORT(r, "%s%d%s", REPORT_DAEMON, daemon_state, eol);
   REPORT(r, "%s%d%s", REPORT_RETCODE, user_code, eol);
 
-  /* add memory digest to cumulative digests if asked */
-  if(nap != NULL && nap->manifest != NULL)
-    if(nap->manifest->mem_tag != NULL)
-      ReportTag(STDRAM, GetMemoryDigest(nap));
-
   /* report tags digests and remove ending " " if exist */
   REPORT(r, "%s", REPORT_ETAG);
   REPORT(r, "%s", digests->len == 0
@@ -249,12 +551,49 @@ void Report(struct NaClApp *nap)
   g_string_truncate(r, r->len - 1);
 
   /* report accounting and session message */
-  if(zvm_state == NULL) zvm_state = UNKNOWN_STATE;
   REPORT(r, "%s%s%s%s", eol, REPORT_ACCOUNTING, acc, eol);
-  REPORT(r, "%s%s%s", REPORT_STATE,
-      zvm_state == NULL ? UNKNOWN_STATE : zvm_state, eol);
+  REPORT(r, "%s%s%s", REPORT_STATE, zvm_state, eol);
   REPORT(r, "%s%s", REPORT_CMD, eol);
-  OutputReport(r->str);
+}
+#undef REPORT
+
+/* part of report class dtor */
+void Report(struct NaClApp *nap)
+{
+  GString *r = g_string_sized_new(BIG_ENOUGH_STRING);
+  char *acc = FinalAccounting();
+  char memory[TAG_DIGEST_SIZE + 1];
+  struct Accounting raw;
+  int format = report_format;
+
+  /* add memory digest to cumulative digests if asked */
+  *memory = '\0';
+  if(nap != NULL && nap->manifest != NULL)
+    if(nap->manifest->mem_tag != NULL)
+    {
+      ReportTag(STDRAM, GetMemoryDigest(nap));
+      TagDigest(nap->manifest->mem_tag, memory);
+    }
+
+  /* syslog cannot hold binary data */
+  if(report_mode == 1 && format == BinaryReport) format = JsonReport;
+  if(zvm_state == NULL) zvm_state = g_strdup(UNKNOWN_STATE);
+
+  GetAccounting(&raw);
+  huge_pages = HugePagesCoverage(nap);
+  switch(format)
+  {
+    case JsonReport:
+      ReportJson(r, &raw, *memory == '\0' ? NULL : memory);
+      break;
+    case BinaryReport:
+      ReportBinary(r, &raw, *memory == '\0' ? NULL : memory);
+      break;
+    default:
+      ReportText(r, acc);
+      break;
+  }
+  OutputReport(r->str, r->len);
 
   g_string_free(r, TRUE);
   g_free(acc);
@@ -278,6 +617,20 @@ void ReportDtor(int zvm_ret)
   ZTrace("[channels destruction]");
   Report(gnap);
   ZTrace("[report]");
+
+  /*
+   * fast exit: close the report handle, so the report reader does not
+   * wait for the user memory (84gb reservation) to be unmapped
+   */
+  if(fast_exit)
+  {
+    if(report_mode != 1) close(report_handle);
+    ZLogDtor();
+    ZTrace("[fast exit]");
+    ZTraceDtor(1);
+    _exit(zvm_code);
+  }
+
   NaClAppDtor(gnap); /* free user space and globals */
   ZTrace("[untrusted context closing]");
   ManifestDtor(gnap->manifest); /* dispose manifest and channels */
@@ -289,6 +642,7 @@ void ReportDtor(int zvm_ret)
 
   /* free local resources and exit */
   g_string_free(digests, TRUE);
+  g_ptr_array_free(channels, TRUE);
   g_string_free(cmd, TRUE);
   g_free(zvm_state);
 
@@ -25,14 +25,70 @@
 #define UNKNOWN_STATE "unknown error, see syslog"
 #define OK_STATE "ok"
 
+/* report formats (see "-R" switch) */
+enum ReportFormats {
+  TextReport, /* positional text lines (default) */
+  JsonReport, /* single json object */
+  BinaryReport /* type-length-value records */
+};
+
+/*
+ * (x-macro): binary report record types. each record is 1 byte type,
+ * 4 bytes length and "length" bytes of value (host byte order). integers
+ * are int64, times are double (seconds), i/o counters are 4 int64 (gets,
+ * get size, puts, put size), strings are not null terminated. "Channel"
+ * value is the sequence of nested channel records (Alias..Eof). "Startup"
+ * value is the sequence of nested "Phase" records (phase time as double
+ * followed by the phase name) and "PeakRSS" (kilobytes by startup end).
+ * "HugePages" is the user memory backed by huge pages, "NumaNodes" is
+ * the bitmask of numa nodes the session is bound to (both if asked).
+ * "Memory" is 4 int64
+ * (peak rss in kilobytes, minor and major page faults, touched heap bytes)
+ */
+#define REPORT_RECORDS \
+    X(Validator) \
+    X(Daemon) \
+    X(UserCode) \
+    X(ExitCode) \
+    X(State) \
+    X(SysTime) \
+    X(UserTime) \
+    X(WallTime) \
+    X(LocalIO) \
+    X(NetworkIO) \
+    X(MemoryEtag) \
+    X(Channel) \
+    X(Alias) \
+    X(Etag) \
+    X(Counters) \
+    X(Size) \
+    X(Eof) \
+    X(Command) \
+    X(Startup) \
+    X(Phase) \
+    X(PeakRSS) \
+    X(HugePages) \
+    X(NumaNodes) \
+    X(Memory)
+
+#define X(a) Record ## a,
+enum ReportRecords {RecordNone, REPORT_RECORDS RecordsNumber};
+#undef X
+
 EXTERN_C_BEGIN
 
 /* assign file handle to put report */
 void SetReportHandle(int handle);
 
+/* skip the deallocations after the report (see ReportDtor) */
+void ReportFastExit();
+
 /* put report to syslog instead of stdout */
 void ReportMode(int mode);
 
+/* set report format: text (default), json or binary */
+void ReportFormat(int format);
+
 /* set the text for "exit state" in report */
 void SetExitState(const char *state);
 
@@ -57,9 +113,27 @@ void SetCmdString(GString *s);
 /* add tag digest with given name */
 void ReportTag(char *name, void *tag);
 
+/*
+ * mark the end of the startup phase. the time passed since the previous
+ * mark is put to json and binary reports under the given (static) name
+ */
+void ReportPhase(const char *name);
+
+/* set the numa nodes (bitmask) the session is bound to */
+void ReportNumaNodes(uint64_t nodes);
+
+/* add channel summary (etag, counters, size and eof) to report */
+void ReportChannel(struct ChannelDesc *channel);
+
 /* initialize report internals */
 void ReportCtor();
 
+/*
+ * forget the previous session (channels, etags, exit state, startup
+ * phases) and restart the wall time for the next session of the process
+ */
+void ReportReset();
+
 /*
  * report intermediate session statistics as often as defined by QUANT
  * TODO(d'b): self-initializing. move it to ReportCtor()
@@ -74,6 +148,8 @@ void Report(struct NaClApp *nap);
 /*
  * exit zerovm. if code != 0 log it and show dump. release resources
  * note: use global nap because can be invoked from signal handler
+ * note: in the fast exit mode the report handle is closed right after
+ *       the report and the user memory is left to the kernel
  */
 void ReportDtor(int code);
 
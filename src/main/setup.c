@@ -17,13 +17,26 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <sched.h>
 #include <sys/resource.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include "src/loader/sel_ldr.h"
 #include "src/platform/sel_memory.h"
 #include "src/main/setup.h"
+#include "src/main/report.h"
 #include "src/channels/channel.h"
 
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+#define NODES_LIMIT 64 /* bits in "NumaNodes" mask */
+#define POLICY_BIND 2 /* MPOL_BIND from numaif.h */
+
+static uintptr_t heap_grown = 0; /* end of the accessible lazy heap */
+static int64_t heap_chunk = 0; /* lazy heap growth step or 0 */
+static uintptr_t heap_start = 0; /* heap without r/w data */
+static uintptr_t heap_first = 0; /* end of the heap accessible from start */
+static char *data_image = NULL; /* r/w data as loaded (see ResetMemory) */
+static int64_t data_size = 0;
 static char *ztrace_name = NULL;
 static GTimer *timer = NULL;
 static FILE *ztrace_log = NULL;
@@ -125,6 +138,136 @@ void LastDefenseLine(struct Manifest *manifest)
   GiveUpPrivileges();
 }
 
+/*
+ * add the cpus of the list (like "0-5,64-69") to the set. return 0 if
+ * the list is invalid
+ */
+static int CpuList(const char *list, cpu_set_t *cpus)
+{
+  char **ranges = g_strsplit(list, ",", 0);
+  int result = ranges[0] != NULL;
+  int i;
+
+  for(i = 0; ranges[i] != NULL && result; ++i)
+  {
+    int first;
+    int last;
+    int end = 0;
+
+    switch(sscanf(g_strstrip(ranges[i]), "%d%n-%d%n", &first, &end, &last, &end))
+    {
+      case 1:
+        last = first;
+        /* no break */
+      case 2:
+        result = ranges[i][end] == '\0'
+            && first >= 0 && first <= last && last < CPU_SETSIZE;
+        for(; first <= last && result; ++first)
+          CPU_SET(first, cpus);
+        break;
+      default:
+        result = 0;
+        break;
+    }
+  }
+
+  g_strfreev(ranges);
+  return result;
+}
+
+/* get cpus of the numa node. return 0 if there is no such node */
+static int NodeCpus(int node, cpu_set_t *cpus)
+{
+  char *path = g_strdup_printf(NODE_CPULIST, node);
+  char *list;
+  int result = g_file_get_contents(path, &list, NULL, NULL);
+
+  CPU_ZERO(cpus);
+  if(result)
+  {
+    CpuList(g_strstrip(list), cpus);
+    g_free(list);
+  }
+  g_free(path);
+  return result;
+}
+
+void SetAffinity(struct Manifest *manifest)
+{
+  uint64_t nodes = manifest->options[SessionNumaNodes];
+  cpu_set_t set;
+  cpu_set_t node;
+  int i;
+
+  if(nodes == 0 && manifest->cpus == NULL) return;
+
+  /* the given cpus or all cpus of the given nodes */
+  CPU_ZERO(&set);
+  if(manifest->cpus != NULL)
+    ZLOGFAIL(!CpuList(manifest->cpus, &set), EINVAL,
+        "invalid cpu list %s", manifest->cpus);
+  else
+    for(i = 0; i < NODES_LIMIT; ++i)
+      if(nodes >> i & 1)
+      {
+        ZLOGFAIL(!NodeCpus(i, &node), EINVAL, "numa node %d not found", i);
+        CPU_OR(&set, &set, &node);
+      }
+  ZLOGFAIL(sched_setaffinity(0, sizeof set, &set) != 0,
+      errno, "cannot set cpu affinity");
+
+  /* memory allocated from now on (i/o buffers, heap) is put to the nodes */
+  if(nodes != 0)
+    ZLOGFAIL(syscall(SYS_set_mempolicy, POLICY_BIND, &nodes, NODES_LIMIT + 1),
+        errno, "cannot bind memory to numa nodes");
+
+  /* the session runs on the nodes of the given cpus */
+  if(manifest->cpus != NULL && nodes == 0)
+    for(i = 0; i < NODES_LIMIT && NodeCpus(i, &node); ++i)
+    {
+      CPU_AND(&node, &node, &set);
+      if(CPU_COUNT(&node) > 0) nodes |= 1LLU << i;
+    }
+  ReportNumaNodes(nodes);
+}
+
+/*
+ * advise transparent huge pages for the heap (HugePages = 1) or for the
+ * heap and the text (HugePages = 2). the user space is 2mb aligned, so
+ * every whole 2mb of the regions can be backed by a huge page
+ */
+static void HugePages(struct NaClApp *nap, void *heap, int64_t size)
+{
+  int64_t mode = nap->manifest->options[SessionHugePages];
+
+  if(mode == 0) return;
+  ZLOGFAIL(mode > 2, EFAULT, "invalid huge pages mode %ld", mode);
+
+  ZLOGIF(NaCl_madvise(heap, size, MADV_HUGEPAGE) != 0,
+      "cannot advise huge pages for heap");
+  if(mode == 2)
+    ZLOGIF(NaCl_madvise((void*)nap->mem_map[TextIdx].start,
+        nap->mem_map[TextIdx].size, MADV_HUGEPAGE) != 0,
+        "cannot advise huge pages for text");
+}
+
+int GrowHeap(struct NaClApp *nap, uintptr_t addr)
+{
+  uintptr_t end;
+
+  /* only the inaccessible part of the heap can grow */
+  if(heap_chunk == 0 || nap == NULL) return 0;
+  if(addr < heap_grown || addr >= nap->mem_map[HeapIdx].end) return 0;
+
+  end = heap_grown + (addr - heap_grown) / heap_chunk * heap_chunk + heap_chunk;
+  end = MIN(end, nap->mem_map[HeapIdx].end);
+  if(NaCl_mprotect((void*)heap_grown, end - heap_grown, PROT_READ | PROT_WRITE))
+    return 0;
+
+  heap_grown = end;
+  return 1;
+}
+
 void PreallocateUserMemory(struct NaClApp *nap)
 {
   uintptr_t i;
@@ -143,15 +286,86 @@ void PreallocateUserMemory(struct NaClApp *nap)
   heap = nap->manifest->mem_size - nap->stack_size;
   heap = ROUNDUP_64K(heap) - ROUNDUP_64K(nap->data_end);
   ZLOGFAIL(heap <= LEAST_USER_HEAP_SIZE, ENOMEM, "user heap size is too small");
+  ZLOGFAIL((uintptr_t)p + heap > StackEnd(nap) - nap->stack_size,
+      ENOMEM, "user heap overlaps the stack");
 
-  /* since 4gb of user space is already allocated just set protection to the heap */
+  /*
+   * since 4gb of user space is already allocated just set protection to
+   * the heap. the lazy heap only opens the 1st chunk, the rest is opened
+   * by GrowHeap() on access
+   */
   p = (void*)NaClUserToSys(nap, (uintptr_t)p);
-  i = NaCl_mprotect(p, heap, PROT_READ | PROT_WRITE);
+  heap_chunk = ROUNDUP_64K(nap->manifest->options[SessionLazyHeap]);
+  heap_grown = (uintptr_t)p + (heap_chunk == 0 ? heap : MIN(heap_chunk, heap));
+  heap_start = (uintptr_t)p;
+  heap_first = heap_grown;
+  i = NaCl_mprotect(p, heap_grown - (uintptr_t)p, PROT_READ | PROT_WRITE);
   ZLOGFAIL(0 != i, -i, "cannot set protection on user heap");
+  HugePages(nap, p, heap);
+
+  /* place the whole heap to the numa nodes (pages are not touched yet) */
+  if(nap->manifest->options[SessionNumaNodes] != 0)
+    ZLOGFAIL(syscall(SYS_mbind, p, heap, POLICY_BIND,
+        &nap->manifest->options[SessionNumaNodes], NODES_LIMIT + 1, 0),
+        errno, "cannot bind user heap to numa nodes");
   nap->heap_end = NaClSysToUser(nap, (uintptr_t)p + heap);
 
   nap->mem_map[HeapIdx].size += heap;
   nap->mem_map[HeapIdx].end += heap;
+
+  /* keep the r/w data untouched by the user to reset the memory later */
+  if(nap->manifest->options[SessionResetMemory] != 0 && nap->data_start != 0)
+  {
+    data_size = nap->data_end - nap->data_start;
+    data_image = g_memdup((void*)NaClUserToSys(nap, nap->data_start), data_size);
+  }
+}
+
+/* drop the pages of the area (they read back as zeroes) */
+static void DropPages(uintptr_t start, uintptr_t end, const char *name)
+{
+  if(end <= start) return;
+  ZLOGFAIL(NaCl_madvise((void*)start, end - start, MADV_DONTNEED) != 0,
+      EFAULT, "cannot reset %s", name);
+}
+
+void ResetUserMemory(struct NaClApp *nap)
+{
+  struct MemBlock *sys;
+  struct MemBlock *stack;
+  uintptr_t start;
+  uintptr_t end;
+  int code;
+
+  assert(nap != NULL);
+  assert(nap->manifest != NULL);
+  ZLOGFAIL(nap->manifest->options[SessionResetMemory] == 0,
+      EFAULT, "memory reset is not enabled");
+
+  /* r/w data (if any) and heap. user manifest is rebuilt by SetSystemData() */
+  start = nap->data_start == 0 ? heap_start : nap->mem_map[HeapIdx].start;
+  end = nap->mem_map[HeapIdx].end;
+  sys = &nap->mem_map[SysDataIdx];
+  stack = &nap->mem_map[StackIdx];
+  DropPages(start, end, "heap");
+  DropPages(sys->start, sys->end, "user manifest");
+  DropPages(stack->start, stack->end, "stack");
+  code = NaCl_mprotect((void*)sys->start, sys->size, PROT_NONE);
+  ZLOGFAIL(code != 0, -code, "cannot reset user manifest protection");
+
+  /* jailed pages become data again, the lazy heap shrinks to the 1st step */
+  code = NaCl_mprotect((void*)start, heap_first - start, PROT_READ | PROT_WRITE);
+  ZLOGFAIL(code != 0, -code, "cannot reset heap protection");
+  if(heap_first < end)
+  {
+    code = NaCl_mprotect((void*)heap_first, end - heap_first, PROT_NONE);
+    ZLOGFAIL(code != 0, -code, "cannot reset lazy heap protection");
+  }
+  heap_grown = heap_first;
+
+  /* initialized data from the image kept on the heap preallocation */
+  if(data_image != NULL)
+    memcpy((void*)NaClUserToSys(nap, nap->data_start), data_image, data_size);
 }
 
 /* TODO(d'b): move it to sel_addrspace */
@@ -183,7 +397,7 @@ static void SetUserManifestPtr(struct NaClApp *nap, void *mft)
 {
   uintptr_t *p;
 
-  p = (void*)NaClUserToSys(nap, FOURGIG - nap->stack_size - USER_PTR_SIZE);
+  p = (void*)NaClUserToSys(nap, USER_MANIFEST_TOP - USER_PTR_SIZE);
   *p = NaClSysToUser(nap, (uintptr_t)mft);
 }
 
@@ -225,16 +439,17 @@ static void ProtectUserManifest(struct NaClApp *nap, void *mft)
   uintptr_t page_ptr;
   uint64_t size;
 
-  size = FOURGIG - nap->stack_size - NaClSysToUser(nap, (uintptr_t)mft);
+  size = USER_MANIFEST_TOP - NaClSysToUser(nap, (uintptr_t)mft);
   page_ptr = AlignAndProtect((uintptr_t) mft, size, PROT_READ);
 
   /* update mem_map */
   SET_MEM_MAP_IDX(nap->mem_map[SysDataIdx], "UserManifest",
       page_ptr, ROUNDUP_64K(size + ((uintptr_t)mft - page_ptr)), PROT_READ);
 
-  /* its time to add hole to memory map */
+  /* its time to add hole to memory map (up to the stack if it is lower) */
   page_ptr = nap->mem_map[HeapIdx].end;
-  size = nap->mem_map[SysDataIdx].start - nap->mem_map[HeapIdx].end;
+  size = MIN(nap->mem_map[SysDataIdx].start, nap->mem_map[StackIdx].start)
+      - nap->mem_map[HeapIdx].end;
   SET_MEM_MAP_IDX(nap->mem_map[HoleIdx], "Hole", page_ptr, size, PROT_NONE);
 
   /*
@@ -269,12 +484,12 @@ void SetSystemData(struct NaClApp *nap)
    */
   size = manifest->channels->len * CHANNEL_STRUCT_SIZE;
   size += USER_MANIFEST_STRUCT_SIZE + USER_PTR_SIZE;
-  ptr = (void*)(FOURGIG - nap->stack_size - size);
+  ptr = (void*)(USER_MANIFEST_TOP - size);
   user_manifest = (void*)NaClUserToSys(nap, (uintptr_t)ptr);
   channels = (void*)((uintptr_t)&user_manifest->channels + USER_PTR_SIZE);
 
   /* make the 1st page of user manifest writable */
-  CopyDown((void*)NaClUserToSys(nap, FOURGIG - nap->stack_size), "");
+  CopyDown((void*)NaClUserToSys(nap, USER_MANIFEST_TOP), "");
   ptr = user_manifest;
 
   /* initialize pointer to user manifest */
@@ -300,6 +515,8 @@ void SetSystemData(struct NaClApp *nap)
 
   /* update heap_size in the user manifest */
   size = ROUNDDOWN_64K(NaClSysToUser(nap, (uintptr_t)ptr));
+  ZLOGFAIL(StackEnd(nap) < USER_MANIFEST_TOP && size < StackEnd(nap),
+      ENOMEM, "user manifest is too large for the stack placement");
   size = MIN(nap->heap_end, size);
   user_manifest->heap_size = size - nap->break_addr;
 
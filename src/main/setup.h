@@ -25,10 +25,13 @@ EXTERN_C_BEGIN
 
 #define HELP_SCREEN /* update command line switches here */\
     "%s%s\033[1m\033[37mZeroVM tag%d\033[0m lightweight VM manager, build 2013-12-02\n"\
-    "Usage: <manifest> [-v#] [-T#] [-stFPQ]\n\n"\
+    "Usage: <manifest> [manifest...] [-v#] [-l#] [-T#] [-R#] [-stEFPQ]\n\n"\
     " -s skip validation\n"\
     " -t <0..2> report to stdout/log/fast (default 0)\n"\
+    " -R <0..2> report format text/json/binary (default 0)\n"\
     " -v <0..3> log verbosity (default 0)\n"\
+    " -l <file> buffered log to the file instead of syslog\n"\
+    " -E fast exit: report, then leave the memory to the kernel\n"\
     " -F quit right before starting user session\n"\
     " -P disable channels space preallocation\n"\
     " -Q disable platform qualification\n"\
@@ -45,9 +48,31 @@ int NaClSegmentValidates(uint8_t* mbase, size_t size, uint32_t vbase);
  */
 void LastDefenseLine();
 
+/*
+ * bind the session to the numa nodes and/or cpus given with "NumaNodes"
+ * and "CpuSet" session options and report the nodes (the nodes of the
+ * given cpus if only "CpuSet" is there). abort if fail
+ */
+void SetAffinity(struct Manifest *manifest);
+
 /* preallocate memory area of given size. abort if fail */
 void PreallocateUserMemory(struct NaClApp *nap);
 
+/*
+ * open the lazy heap (see "LazyHeap" session option) up to the given
+ * system address. return 1 if the heap has grown, otherwise 0
+ * note: signal safe, used by the access fault handler
+ */
+int GrowHeap(struct NaClApp *nap, uintptr_t addr);
+
+/*
+ * reset the user memory to the state before the session start (see
+ * "ResetMemory" session option): the heap, the stack and the user
+ * manifest pages are dropped and the r/w data is copied again from the
+ * image kept by PreallocateUserMemory(). abort if fail
+ */
+void ResetUserMemory(struct NaClApp *nap);
+
 /* serialize system data to user space */
 void SetSystemData(struct NaClApp *nap);
 
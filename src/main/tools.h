@@ -102,4 +102,7 @@ static INLINE void *NaClArrayCheckHelper(void *arg)
 /* return size of given file or negative error code */
 int64_t GetFileSize(const char *name);
 
+/* ask the kernel to read the file into the page cache in background */
+void PrefetchFile(const char *name);
+
 #endif /* TOOLS_H_ */
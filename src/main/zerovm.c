@@ -30,6 +30,7 @@
 #include "src/main/accounting.h"
 #include "src/main/tools.h"
 #include "src/channels/preload.h"
+#include "src/syscalls/daemon.h"
 
 #define BADCMDLINE(msg) \
   do { \
@@ -40,6 +41,7 @@
 static int skip_qualification = 0;
 static int skip_validation = 0;
 static int quit_after_load = 0;
+static int runner = 0;
 
 /* log zerovm command line. note: delegates g_string_free to report */
 static void CommandLine(int argc, char **argv)
@@ -65,14 +67,19 @@ static void ParseCommandLine(struct NaClApp *nap, int argc, char **argv)
   ZLogCtor(LOG_ERROR);
   CommandLine(argc, argv);
 
-  while((opt = getopt(argc, argv, "-PFQst:v:M:T:")) != -1)
+  while((opt = getopt(argc, argv, "-PFQEsR:t:v:l:M:T:")) != -1)
   {
     switch(opt)
     {
       case 1:
       case 'M':
+        /* the next manifests are the runner jobs */
         if(manifest_name != NULL)
-          BADCMDLINE("2nd manifest encountered");
+        {
+          RunnerJob(optarg);
+          runner = 1;
+          break;
+        }
         manifest_name = optarg;
         break;
       case 's':
@@ -82,13 +89,22 @@ static void ParseCommandLine(struct NaClApp *nap, int argc, char **argv)
       case 'F':
         quit_after_load = 1;
         break;
+      case 'E':
+        ReportFastExit();
+        break;
       case 't':
         ReportMode(ToInt(optarg));
         break;
+      case 'R':
+        ReportFormat(ToInt(optarg));
+        break;
       case 'v':
         ZLogDtor();
         ZLogCtor(ToInt(optarg));
         break;
+      case 'l':
+        ZLogFile(optarg);
+        break;
       case 'Q':
         skip_qualification = 1;
         ZLOGS(LOG_ERROR, "PLATFORM QUALIFICATION DISABLED");
@@ -109,11 +125,25 @@ static void ParseCommandLine(struct NaClApp *nap, int argc, char **argv)
   /* parse manifest file specified in command line */
   if(manifest_name == NULL) BADCMDLINE(NULL);
   nap->manifest = ManifestCtor(manifest_name);
+  if(runner) nap->manifest->options[SessionResetMemory] = 1;
+  if(nap->manifest->options[SessionStackSize] != 0)
+  {
+    int64_t size = nap->manifest->options[SessionStackSize];
+
+    /* the big stack ends below the user manifest */
+    ZLOGFAIL(size < STACK_USER_DATA_SIZE || ROUNDUP_64K(size)
+        >= USER_MANIFEST_TOP - USER_MANIFEST_LIMIT,
+        ENOMEM, "invalid stack size %ld", size);
+    nap->stack_size = ROUNDUP_64K(size);
+  }
 
   /* set available nap and manifest fields */
   ZLOGFAIL(nap->manifest->program == NULL, EFAULT, "program not specified");
   psize = GetFileSize(nap->manifest->program);
   ZLOGFAIL(psize < 0, ENOENT, "program open error");
+
+  /* read the program while the platform is qualified */
+  PrefetchFile(nap->manifest->program);
 }
 
 static void ValidateProgram(struct NaClApp *nap)
@@ -155,25 +185,32 @@ int main(int argc, char **argv)
   ReportCtor();
   NaClAppCtor(nap);
   ParseCommandLine(nap, argc, argv);
+  SetAffinity(nap->manifest);
+  ReportPhase("command_line");
 
   /* We use the signal handler to verify a signal took place. */
   if(skip_qualification == 0) RunSelQualificationTests();
+  ReportPhase("qualification");
   SignalHandlerInit();
+  ReportPhase("signals");
 
   /* read elf into memory */
   ZLOGFAIL(0 == GioMemoryFileSnapshotCtor(&main_file, nap->manifest->program),
       ENOENT, "Cannot open '%s'. %s", nap->manifest->program, strerror(errno));
   ZTrace("[memory snapshot]");
+  ReportPhase("elf_read");
 
   /* validate program structure (check elf header and segments) */
   ZLOGS(LOG_DEBUG, "Loading %s", nap->manifest->program);
   AppLoadFile((struct Gio *) &main_file, nap);
   ZTrace("[user module loading]");
+  ReportPhase("load");
 
   /* validate given program (ensure that text segment is safe) */
   ZLOGS(LOG_DEBUG, "Validating %s", nap->manifest->program);
   if(!skip_validation) ValidateProgram(nap);
   ZTrace("[user module validation]");
+  ReportPhase("validation");
 
   /* free snapshot */
   if(-1 == (*((struct Gio *)&main_file)->vtbl->Close)((struct Gio *)&main_file))
@@ -181,10 +218,11 @@ int main(int argc, char **argv)
   (*((struct Gio *) &main_file)->vtbl->Dtor)((struct Gio *) &main_file);
   ZTrace("[snapshot deallocation]");
 
-  /* initialize all channels */
-  ChannelsCtor(nap->manifest);
-  ZLOGS(LOG_DEBUG, "channels constructed");
+  /* mount local channels while the name service is polled */
+  ChannelsMount(nap->manifest);
+  ZLOGS(LOG_DEBUG, "local channels constructed");
   ZTrace("[channels mounting]");
+  ReportPhase("channels");
 
   /*
    * allocate user heap. should be the last allocation in raw because
@@ -193,15 +231,24 @@ int main(int argc, char **argv)
   PreallocateUserMemory(nap);
   ZLOGS(LOG_DEBUG, "user memory preallocated");
   ZTrace("[user memory preallocation]");
+  ReportPhase("heap");
+
+  /* wait for the name service and mount network channels */
+  ChannelsJoin(nap->manifest);
+  ZLOGS(LOG_DEBUG, "channels constructed");
+  ZTrace("[name service]");
+  ReportPhase("name_service");
 
   /* set user manifest in user space */
   SetSystemData(nap);
   ZLOGS(LOG_DEBUG, "system data set");
   ZTrace("[user manifest construction]");
+  ReportPhase("manifest");
 
   /* "defense in depth" call */
   ZLOGS(LOG_DEBUG, "Last preparations");
   LastDefenseLine(nap->manifest);
+  ReportPhase("defense");
 
   /* quit if fuzz testing specified */
   if(quit_after_load)
@@ -23,61 +23,144 @@
 #define ZLOG_FACILITY LOG_USER
 #define ZLOG_PRIORITY LOG_ERROR
 #define TAG_FORMAT "%s %d: "
+#define STAMP_FORMAT "%ld.%06ld %s[%d]: "
 #define LOG_MSG_LIMIT 0x1000
+#define LOG_BUFFER_SIZE 0x10000 /* must be bigger than LOG_MSG_LIMIT */
 
-static int verbosity = 0;
+int zlog_verbosity = 0;
 static int zline = 0;
 static const char *zfile = NULL;
 
+/*
+ * messages are stored null terminated one after another and flushed
+ * when the buffer cannot hold the next message, on error and on exit
+ */
+static char buffer[LOG_BUFFER_SIZE];
+static int used = 0;
+static int handle = -1; /* log file or -1 for syslog */
+
 void ZLogCtor(int v)
 {
-  verbosity = MAX(v, 0);
+  zlog_verbosity = MAX(v, 0);
   openlog(ZLOG_NAME, ZLOG_OPTIONS, ZLOG_FACILITY);
 }
 
 void ZLogDtor()
 {
-  verbosity = 0;
+  ZLogFlush();
+  zlog_verbosity = 0;
   closelog();
 }
 
+void ZLogFile(const char *name)
+{
+  ZLogFlush();
+  if(handle >= 0) close(handle);
+  handle = -1;
+  if(name == NULL) return;
+
+  handle = open(name, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+  ZLOGFAIL(handle < 0, errno, "cannot open log file %s", name);
+}
+
+void ZLogFlush()
+{
+  char *p;
+  size_t len;
+
+  if(used == 0) return;
+
+  /* file: replace terminators with eols and write all at once */
+  if(handle >= 0)
+  {
+    for(p = buffer; p < buffer + used; p += len + 1)
+    {
+      len = strlen(p);
+      p[len] = '\n';
+    }
+    if(write(handle, buffer, used) != used)
+      syslog(ZLOG_PRIORITY, "log file write error: %s", strerror(errno));
+  }
+  else
+    for(p = buffer; p < buffer + used; p += strlen(p) + 1)
+      syslog(ZLOG_PRIORITY, "%s", p);
+
+  used = 0;
+}
+
 void ZLogTag(const char *file, int line)
 {
   zline = line;
   zfile = file;
 }
 
-#define ZLO(cond) \
-  char msg[LOG_MSG_LIMIT];\
-  int offset = 0;\
-  va_list ap;\
-\
-  if(cond) return;\
-\
-  /* construct log message */\
-  va_start(ap, fmt);\
-  if(zfile != NULL)\
-    offset = g_snprintf(msg, LOG_MSG_LIMIT, TAG_FORMAT, zfile, zline);\
-  g_vsnprintf(msg + offset, LOG_MSG_LIMIT - offset, fmt, ap);\
-  va_end(ap);\
-\
-  /* log the message */\
-  syslog(ZLOG_PRIORITY, "%s", msg);
+/* put message to the buffer, return the message text (w/o stamp) */
+static char *Append(char const *fmt, va_list ap)
+{
+  int size;
+  char *msg;
+
+  /* free buffer space if needed */
+  if(LOG_BUFFER_SIZE - used < LOG_MSG_LIMIT) ZLogFlush();
+  msg = buffer + used;
+  size = 0;
+
+  /* the file has no syslog prefix, so add it */
+  if(handle >= 0)
+  {
+    int64_t now = g_get_real_time();
+    size = g_snprintf(msg, LOG_MSG_LIMIT, STAMP_FORMAT, now / MICRO_PER_SEC,
+        now % MICRO_PER_SEC, ZLOG_NAME, getpid());
+  }
+  msg += size;
+
+  /* construct log message */
+  if(zfile != NULL)
+    size += g_snprintf(msg, LOG_MSG_LIMIT - size, TAG_FORMAT, zfile, zline);
+  size += g_vsnprintf(buffer + used + size, LOG_MSG_LIMIT - size, fmt, ap);
+
+  used += MIN(size, LOG_MSG_LIMIT - 1) + 1;
+  return msg;
+}
 
 void ZLog(int priority, char *fmt, ...)
 {
-  ZLO(priority > verbosity);
+  va_list ap;
+
   assert(priority != LOG_FATAL);
+  if(priority > zlog_verbosity) return;
+
+  va_start(ap, fmt);
+  Append(fmt, ap);
+  va_end(ap);
+
+  /* errors are rare and must survive the sudden death */
+  if(priority == LOG_ERROR) ZLogFlush();
 }
 
 void LogIf(int cond, char const *fmt, ...)
 {
-  ZLO(!cond);
+  va_list ap;
+
+  if(!cond) return;
+
+  va_start(ap, fmt);
+  Append(fmt, ap);
+  va_end(ap);
+  ZLogFlush();
 }
 
 void FailIf(int cond, int err, char const *fmt, ...)
 {
-  ZLO(!cond);
+  va_list ap;
+  char *msg;
+
+  if(!cond) return;
+
+  va_start(ap, fmt);
+  msg = Append(fmt, ap);
+  va_end(ap);
+
   SetExitState(msg);
   ReportDtor(err);
 }
@@ -25,15 +25,20 @@
 EXTERN_C_BEGIN
 
 /*
- * ZLOG(format, ...) - add file and line info to given message and put it to syslog
- * ZLOGS(format, ...) - put given message to syslog
+ * ZLOG(priority, format, ...) - add file and line info to given message and log it
+ * ZLOGS(priority, format, ...) - log given message
  * ZLOGIF(condition, format, ...) - check condition and, if true, ZLOG it
  * ZLOGFAIL(condition, code, format, ...) - check condition, if true, ZLOG it and exit with code
+ * note: ZLOG and ZLOGS do not evaluate arguments if priority is filtered out
  */
-#define ZLOG ZLogTag(__FILE__, __LINE__), ZLog
+#define ZLOG(priority, ...) \
+  do { if((priority) <= zlog_verbosity) \
+    ZLogTag(__FILE__, __LINE__), ZLog(priority, __VA_ARGS__); } while(0)
+#define ZLOGS(priority, ...) \
+  do { if((priority) <= zlog_verbosity) \
+    ZLogTag(NULL, 0), ZLog(priority, __VA_ARGS__); } while(0)
 #define ZLOGIF ZLogTag(__FILE__, __LINE__), LogIf
 #define ZLOGFAIL ZLogTag(__FILE__, __LINE__), FailIf
-#define ZLOGS ZLogTag(NULL, 0), ZLog
 #define FAILED_MSG "check failed"
 
 /* develop fix for verbosity level names */
@@ -44,12 +49,24 @@ EXTERN_C_BEGIN
 #define LOG_ERROR  1 /* mandatory message */
 #define LOG_FATAL  0 /* for completeness. not used */
 
+/* current verbosity. read only, use ZLogCtor() to change */
+extern int zlog_verbosity;
+
 /* initialize syslog with verbosity */
 void ZLogCtor(int v);
 
-/* close the log, reset verbosity level */
+/* flush and close the log, reset verbosity level */
 void ZLogDtor();
 
+/*
+ * log to the given file instead of syslog. NULL switches back to syslog.
+ * the file survives ZLogDtor() (verbosity changes, daemon sessions)
+ */
+void ZLogFile(const char *name);
+
+/* put buffered messages to the log (should be called before fork) */
+void ZLogFlush();
+
 /*
  * store file and line information to the log tag
  * should be used from ZLOG, ZLOGS, ZLOGIF, ZLOGFAIL
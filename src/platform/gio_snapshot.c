@@ -23,6 +23,7 @@
  * NaCl Generic I/O interface implementation: in-memory snapshot of a file.
  */
 
+#include <sys/mman.h>
 #include "src/platform/gio.h"
 
 struct GioVtbl const  kGioMemoryFileSnapshotVtbl = {
@@ -41,25 +42,36 @@ int64_t GetFileSize(const char *name)
   return fstat(handle, &fs), close(handle) ? -1 : fs.st_size;
 }
 
+void PrefetchFile(const char *name)
+{
+  int handle = open(name, O_RDONLY);
+
+  if(handle < 0) return;
+  posix_fadvise(handle, 0, 0, POSIX_FADV_WILLNEED);
+  close(handle);
+}
+
+/*
+ * the snapshot maps the file privately instead of reading it to the
+ * buffer: the segments are copied to the user space straight from the
+ * page cache, and the pages not read yet are read ahead
+ */
 int GioMemoryFileSnapshotCtor(struct GioMemoryFileSnapshot *self, char *fn)
 {
-  FILE *iop;
+  int handle;
   char *buffer;
   size_t size = GetFileSize(fn);
 
   ((struct Gio *) self)->vtbl = NULL;
-  if(size == (size_t)-1) return 0;
-  iop = fopen(fn, "rb");
-  buffer = g_malloc(size);
+  if(size == (size_t)-1 || size == 0) return 0;
+  handle = open(fn, O_RDONLY);
+  if(handle < 0) return 0;
 
-  if(fread(buffer, 1, size, iop) != size)
-  {
-    g_free(buffer);
-    fclose(iop);
-    return 0;
-  }
+  buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, handle, 0);
+  close(handle);
+  if(buffer == MAP_FAILED) return 0;
+  madvise(buffer, size, MADV_WILLNEED);
 
-  fclose(iop);
   GioMemoryFileCtor(&self->base, buffer, size);
   ((struct Gio *) self)->vtbl = &kGioMemoryFileSnapshotVtbl;
   return 1;
@@ -68,6 +80,6 @@ int GioMemoryFileSnapshotCtor(struct GioMemoryFileSnapshot *self, char *fn)
 void GioMemoryFileSnapshotDtor(struct Gio *vself)
 {
   struct GioMemoryFileSnapshot *self = (struct GioMemoryFileSnapshot *) vself;
-  g_free(self->base.buffer);
+  munmap(self->base.buffer, self->base.len);
   GioMemoryFileDtor(vself);
 }
@@ -172,6 +172,7 @@ static void SignalCatch(int sig, siginfo_t *info, void *uc)
 {
   busy = 1;
   FindAndRunHandler(sig, info, uc);
+  busy = 0;
 }
 
 /* Assert that no signal handlers are registered */
@@ -21,6 +21,7 @@
 
 #include "src/platform/signal.h"
 #include "src/main/report.h"
+#include "src/main/setup.h"
 #include "src/loader/sel_ldr.h"
 
 #define MAX_HANDLERS 16
@@ -155,6 +156,16 @@ static enum SignalResult SignalHandleAll(int signum, void *ctx)
   return NACL_SIGNAL_RETURN; /* unreachable */
 }
 
+/* open the lazy heap on the access fault inside it */
+static enum SignalResult SignalHandleHeap(int signum, void *ctx)
+{
+  const ucontext_t *uctx = (const ucontext_t *)ctx;
+
+  if(signum != SIGSEGV) return NACL_SIGNAL_SEARCH;
+  return GrowHeap(gnap, uctx->uc_mcontext.gregs[REG_CR2])
+      ? NACL_SIGNAL_RETURN : NACL_SIGNAL_SEARCH;
+}
+
 /*
  * Add a signal handler to the front of the list.
  * Returns an id for the handler or returns 0 on failure.
@@ -221,6 +232,9 @@ void SignalHandlerInit()
 
   /* In stand-alone mode (sel_ldr) we handle all signals. */
   SignalHandlerAdd(SignalHandleAll);
+
+  /* the lazy heap faults are tried first */
+  SignalHandlerAdd(SignalHandleHeap);
 }
 
 /* We try to lock, but since we are shutting down, we ignore failures */
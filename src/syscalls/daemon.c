@@ -18,10 +18,12 @@
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
+#include <sys/mman.h>
 #include "src/main/report.h"
 #include "src/main/setup.h"
 #include "src/main/accounting.h"
 #include "src/platform/signal.h"
+#include "src/platform/sel_memory.h"
 #include "src/channels/channel.h"
 #include "src/syscalls/daemon.h"
 
@@ -29,8 +31,26 @@
 #define TASK_SIZE 0x10000 /* limited by protocol (server <-> zerovm ) */
 #define QUEUE_SIZE 16
 #define CMD_SIZE (sizeof(uint64_t))
+#define PAGEMAP "/proc/self/pagemap"
+#define PAGEMAP_CHUNK 512 /* pagemap entries read at once */
+#define PAGE_WRITTEN (1ULL << 63 | 1ULL << 56) /* present, exclusively mapped */
+#define WORKING_SET_JOBS 4 /* recorded jobs kept in the working set */
+#define WORKING_SET_PERIOD 4 /* one job of so many records its pages */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 /* linux 5.14 */
+#endif
 
 static int client = -1;
+static int sock = -1;
+static int serving = 0; /* the job is served in place (no fork) */
+static GPtrArray *jobs = NULL; /* manifest names of the runner jobs */
+static int next_job = 0;
+static int forked = 0; /* the job session forked by the daemon */
+static uint64_t *working_set = NULL; /* heap pages written by the jobs */
+static uint64_t working_pages = 0;
+static uint64_t working_words = 0; /* size of one job bitmap */
+static uint64_t *job_set = NULL; /* the bitmap of the job or NULL */
+static uint64_t job_number = 0; /* the jobs forked so far */
 
 /*
  * child: get command from inherited command socket. current version can
@@ -64,6 +84,7 @@ static void UpdateSession(struct Manifest *manifest)
   SignalHandlerFini();
   SignalHandlerInit();
   ResetAccounting();
+  ReportReset();
   ReportMode(3);
   SetReportHandle(client);
   ZLogDtor();
@@ -98,10 +119,119 @@ static void UpdateSession(struct Manifest *manifest)
 
     CH_CH(manifest, i)->source = CH_CH(tmp, i)->source;
     CH_CH(manifest, i)->tag = CH_CH(tmp, i)->tag;
+    memcpy(CH_CH(manifest, i)->options, CH_CH(tmp, i)->options,
+        sizeof CH_CH(manifest, i)->options);
   }
   ChannelsCtor(manifest);
 }
 
+/*
+ * daemon: allocate the working set bitmaps (see "ForkPrefault" session
+ * option), one per recorded job. the memory is shared with all job sessions
+ */
+static void WorkingSetCtor(struct NaClApp *nap)
+{
+  if(nap->manifest->options[SessionForkPrefault] == 0) return;
+
+  working_pages = nap->mem_map[HeapIdx].size >> NACL_PAGESHIFT;
+  working_words = (working_pages + 63) / 64;
+  working_set = mmap(NULL, WORKING_SET_JOBS * working_words
+      * sizeof *working_set, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ZLOGFAIL(working_set == MAP_FAILED, errno, "cannot allocate working set");
+}
+
+/*
+ * daemon: choose the bitmap the next job records to. only one job of
+ * WORKING_SET_PERIOD records (the pagemap scan is not free) and it replaces
+ * the oldest record, so the pages not written for a while are dropped
+ */
+static void WorkingSetNext()
+{
+  uint64_t n = job_number++;
+
+  job_set = NULL;
+  if(working_set == NULL || n % WORKING_SET_PERIOD != 0) return;
+
+  job_set = working_set
+      + n / WORKING_SET_PERIOD % WORKING_SET_JOBS * working_words;
+  memset(job_set, 0, working_words * sizeof *job_set);
+}
+
+/* the page was written by any of the recorded jobs */
+static int WorkingSetHas(uint64_t page)
+{
+  uint64_t i;
+
+  for(i = 0; i < WORKING_SET_JOBS; ++i)
+    if(working_set[i * working_words + page / 64] >> page % 64 & 1)
+      return 1;
+  return 0;
+}
+
+/*
+ * child: record the heap pages written by the job (if the job is chosen
+ * to). the written pages are the private copies (exclusively mapped), the
+ * pages only read are still shared with the daemon
+ */
+static void WorkingSetUpdate(struct NaClApp *nap)
+{
+  uint64_t entries[PAGEMAP_CHUNK];
+  uint64_t first = nap->mem_map[HeapIdx].start >> NACL_PAGESHIFT;
+  uint64_t i;
+  int pagemap;
+
+  if(job_set == NULL || !forked) return;
+  pagemap = open(PAGEMAP, O_RDONLY);
+  ZLOGIF(pagemap < 0, "cannot open %s: %s", PAGEMAP, strerror(errno));
+  if(pagemap < 0) return;
+
+  for(i = 0; i < working_pages; i += PAGEMAP_CHUNK)
+  {
+    uint64_t n = MIN(PAGEMAP_CHUNK, working_pages - i);
+    uint64_t j;
+
+    if(pread(pagemap, entries, n * sizeof *entries,
+        (first + i) * sizeof *entries) != n * sizeof *entries) break;
+    for(j = 0; j < n; ++j)
+      if((entries[j] & PAGE_WRITTEN) == PAGE_WRITTEN)
+        __sync_fetch_and_or(&job_set[(i + j) / 64], 1ULL << (i + j) % 64);
+  }
+  close(pagemap);
+}
+
+/*
+ * child: prefault the working set recorded by the previous jobs, so the
+ * job does not take copy-on-write faults page by page. the pages which
+ * cannot be written (e.g. the closed part of the lazy heap) are skipped
+ */
+static void WorkingSetPrefault(struct NaClApp *nap)
+{
+  uint64_t i = 0;
+
+  if(working_set == NULL) return;
+  while(i < working_pages)
+  {
+    uint64_t end;
+
+    if(!WorkingSetHas(i))
+    {
+      ++i;
+      continue;
+    }
+
+    /* populate the whole run of the written pages */
+    for(end = i; end < working_pages && WorkingSetHas(end); ++end);
+    if(NaCl_madvise((void*)(nap->mem_map[HeapIdx].start + (i << NACL_PAGESHIFT)),
+        (end - i) << NACL_PAGESHIFT, MADV_POPULATE_WRITE) == -EINVAL)
+    {
+      ZLOG(LOG_ERROR, "prefault is not supported by the kernel");
+      return;
+    }
+    i = end;
+  }
+}
+
 /* daemon: get the next task: return when accept()'ed */
 static int Job(int sock)
 {
@@ -171,27 +301,56 @@ static int Daemonize(struct NaClApp *nap)
   return sock;
 }
 
-int Daemon(struct NaClApp *nap)
+/*
+ * daemon: serve the job in place (see "ResetMemory" session option). the
+ * user memory is reset and the user program starts from the entry point
+ */
+static NORETURN void Serve(struct NaClApp *nap)
 {
-  pid_t pid;
-  siginfo_t info;
-  int sock;
+  UpdateSession(nap->manifest);
+  ResetUserMemory(nap);
+  SetSystemData(nap);
+  serving = 1;
+  fflush(NULL);
+  RestartSession(nap);
+}
 
-  /* can the daemon be started? */
-  if(nap->manifest->job == NULL) return -1;
-  ZLOGFAIL(GetExitCode(), EFAULT, "broken session");
+/*
+ * daemon: the jobs served in place (see "ResetMemory" session option) run
+ * in the server process. a failed job reports to its client and ends the
+ * server (the failure can come in any state of the trusted code), then
+ * the daemon forks a new server. return in the server
+ */
+static void Supervise(struct NaClApp *nap)
+{
+  pid_t pid;
+  int status = 0;
 
-  /* report the daemon mode launched */
-  SetDaemonState(1);
+  if(nap->manifest->options[SessionResetMemory] == 0) return;
+  for(;;)
+  {
+    ZLogFlush();
+    pid = fork();
+    if(pid == 0) return;
+    if(pid < 0)
+    {
+      ZLOG(LOG_ERROR, "fork failed: %s", strerror(errno));
+      sleep(1);
+      continue;
+    }
 
-  /* finalize user session */
-  umask(0);
-  pid = fork();
-  if(pid != 0) return 0;
+    /* wait for the server to fail */
+    while(waitpid(pid, &status, 0) < 0)
+      if(errno != EINTR) break;
+    ZLOGS(LOG_DEBUG, "server %d ended with 0x%x, restarting", pid, status);
+  }
+}
 
-  /* forked sessions are not in daemon mode */
-  SetDaemonState(0);
-  sock = Daemonize(nap);
+/* daemon: wait for the jobs. return in the forked child session */
+static void Jobs(struct NaClApp *nap)
+{
+  pid_t pid;
+  siginfo_t info;
 
   for(;;)
   {
@@ -207,10 +366,18 @@ int Daemon(struct NaClApp *nap)
       if(waitid(P_ALL, 0, &info, WEXITED | WNOHANG) < 0) break;
     while(info.si_code);
 
+    /* no fork and no page tables rebuild */
+    ZLogFlush();
+    if(nap->manifest->options[SessionResetMemory] != 0)
+      Serve(nap);
+
     /* child: update manifest, continue to the trap */
+    WorkingSetNext();
     pid = fork();
     if(pid == 0)
     {
+      forked = 1;
+      WorkingSetPrefault(nap);
       UpdateSession(nap->manifest);
       break;
     }
@@ -219,6 +386,85 @@ int Daemon(struct NaClApp *nap)
     close(client);
     ZLOGIF(pid < 0, "fork failed: %s", strerror(errno));
   }
+}
+
+int Daemon(struct NaClApp *nap)
+{
+  pid_t pid;
+
+  /* the job served in place forks again: just continue */
+  if(serving) return -1;
+
+  /* can the daemon be started? */
+  if(nap->manifest->job == NULL) return -1;
+  ZLOGFAIL(GetExitCode(), EFAULT, "broken session");
+
+  /* report the daemon mode launched */
+  SetDaemonState(1);
 
+  /* finalize user session */
+  umask(0);
+  ZLogFlush();
+  pid = fork();
+  if(pid != 0) return 0;
+
+  /* forked sessions are not in daemon mode */
+  SetDaemonState(0);
+  sock = Daemonize(nap);
+  WorkingSetCtor(nap);
+  Supervise(nap);
+  Jobs(nap);
   return -1;
 }
+
+void RunnerJob(char *name)
+{
+  if(jobs == NULL) jobs = g_ptr_array_new();
+  g_ptr_array_add(jobs, name);
+}
+
+/*
+ * runner: start the next job from the command line in place. the program
+ * and the memory size are shared by all jobs (loaded for the 1st one)
+ */
+static NORETURN void Run(struct NaClApp *nap, char *name)
+{
+  struct Manifest *manifest = ManifestCtor(name);
+
+  ZLOGFAIL(g_strcmp0(manifest->program, nap->manifest->program) != 0,
+      EFAULT, "%s: runner jobs should have the same program", name);
+  ZLOGFAIL(manifest->mem_size != nap->manifest->mem_size,
+      EFAULT, "%s: runner jobs should have the same memory size", name);
+  ManifestDtor(nap->manifest);
+  nap->manifest = manifest;
+  manifest->options[SessionResetMemory] = 1;
+
+  /* the new session from scratch, but the sandbox is the same */
+  ResetAccounting();
+  ReportReset();
+  ChannelsCtor(manifest);
+  ResetUserMemory(nap);
+  SetSystemData(nap);
+  LastDefenseLine(manifest);
+  ZLOGS(LOG_DEBUG, "runner job %d: %s", next_job, name);
+  fflush(NULL);
+  RestartSession(nap);
+}
+
+void JobDone(struct NaClApp *nap)
+{
+  int runner = jobs != NULL && next_job < jobs->len;
+
+  WorkingSetUpdate(nap);
+  if(!serving && !runner) return;
+
+  /* report to the client (or to the usual place for the runner) */
+  alarm(0);
+  ChannelsDtor(nap->manifest);
+  Report(nap);
+  if(runner) Run(nap, g_ptr_array_index(jobs, next_job++));
+
+  /* wait for the next job */
+  close(client);
+  Jobs(nap);
+}
@@ -26,4 +26,18 @@
  */
 int Daemon(struct NaClApp *nap);
 
+/*
+ * add the manifest of the next runner job. the runner runs the jobs one
+ * by one in the same process resetting the user memory and channels
+ */
+void RunnerJob(char *name);
+
+/*
+ * finish the job served in place by the daemon (see "ResetMemory" session
+ * option) or by the runner: report and start the next job. return at once
+ * if there is no next job. the forked job session only records its working
+ * set (see "ForkPrefault" session option)
+ */
+void JobDone(struct NaClApp *nap);
+
 #endif /* DAEMON_H_ */
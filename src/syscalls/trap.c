@@ -26,7 +26,9 @@ static char *function[] =
   {"TrapRead", "TrapWrite", "TrapJail", "TrapUnjail", "TrapExit", "TrapFork", "n/a"};
 
 /*
- * check "prot" access for user area (start, size)
+ * check "prot" access for user area (start, size). the blocks of mem_map
+ * are not sorted (the big stack is placed below the user manifest) and
+ * the area outside of the blocks is inaccessible
  * if failed return -1, otherwise - 0
  */
 static int CheckRAMAccess(struct NaClApp *nap, uintptr_t start, int64_t size, int prot)
@@ -34,21 +36,20 @@ static int CheckRAMAccess(struct NaClApp *nap, uintptr_t start, int64_t size, in
   int i;
 
   start = NaClUserToSysAddrNullOkay(nap, start);
-  for(i = LeftBumperIdx; i < MemMapSize; ++i)
+  while(size > 0)
   {
-    /* skip until start hit block in mem_map */
-    if(start >= nap->mem_map[i].end) continue;
+    /* find the block containing start */
+    for(i = LeftBumperIdx; i < MemMapSize; ++i)
+      if(start >= nap->mem_map[i].start && start < nap->mem_map[i].end) break;
 
     /* fail if block protection doesn't meat prot */
-    if((prot & nap->mem_map[i].prot) == 0) return -1;
+    if(i == MemMapSize || (prot & nap->mem_map[i].prot) == 0) return -1;
 
     /* subtract checked space from given area */
     size -= (nap->mem_map[i].end - start);
-    if(size <= 0) return 0;
-
     start = nap->mem_map[i].end;
   }
-  return -1;
+  return 0;
 }
 
 /*
@@ -80,6 +81,7 @@ static int32_t ZVMReadHandle(struct NaClApp *nap,
   /* check buffer and convert address */
   if(CheckRAMAccess(nap, (uintptr_t)buffer, size, PROT_WRITE) == -1) return -EINVAL;
   sys_buffer = (char*)NaClUserToSys(nap, (uintptr_t)buffer);
+  if(size > 0) GrowHeap(nap, (uintptr_t)sys_buffer + size - 1);
 
   /* ignore user offset for sequential access read */
   if(CH_SEQ_READABLE(channel))
@@ -141,6 +143,7 @@ static int32_t ZVMWriteHandle(struct NaClApp *nap,
   /* check buffer and convert address */
   if(CheckRAMAccess(nap, (uintptr_t)buffer, size, PROT_READ) == -1) return -EINVAL;
   sys_buffer = (char*)NaClUserToSys(nap, (uintptr_t) buffer);
+  if(size > 0) GrowHeap(nap, (uintptr_t)sys_buffer + size - 1);
 
   /* ignore user offset for sequential access write */
   if(CH_SEQ_WRITEABLE(channel)) offset = channel->putpos;
@@ -246,6 +249,7 @@ static void ZVMExitHandle(struct NaClApp *nap, int32_t code)
     SetExitState(OK_STATE);
   ZLOGS(LOG_DEBUG, "SESSION %d RETURNED %d", nap->manifest->node, code);
   SyscallZTrace(4, function[4], code);
+  JobDone(nap);
   ReportDtor(0);
 }
 
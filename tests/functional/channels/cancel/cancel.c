@@ -0,0 +1,26 @@
+/*
+ * network channel cancellation test. the writer copies all stdin to
+ * stdout, the reader ("reader" in nvram) takes only the 1st chunk of
+ * stdin and leaves. the writer must finish without the reader draining
+ * the rest of the data. returns 0 if there were no errors
+ */
+#include "include/zvmlib.h"
+
+#define CHUNK_SIZE 0x100000
+
+int main(int argc, char **argv)
+{
+  static char buffer[CHUNK_SIZE];
+  int reader = STRCMP(argv[0], "reader") == 0;
+  int count;
+
+  do
+  {
+    count = READ(STDIN, buffer, sizeof buffer);
+    if(count < 0) return 1;
+    if(WRITE(STDOUT, buffer, count) != count) return 2;
+  }
+  while(count > 0 && !reader);
+
+  return 0;
+}
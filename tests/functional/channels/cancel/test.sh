@@ -0,0 +1,17 @@
+#!/bin/sh
+
+printf "\033[01;38mchannel cancellation\033[00m test has"
+
+make clean all>/dev/null
+result=""
+for p in ntcp shm tcp; do
+  grep -qE "^(exit state = )?ok$" ${p}1.report || result="$result ${p} writer"
+  grep -qE "^(exit state = )?ok$" ${p}2.report || result="$result ${p} reader"
+  head -c 1048576 input.data | cmp -s - ${p}.data || result="$result ${p} data"
+done
+if [ "" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
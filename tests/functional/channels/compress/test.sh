@@ -0,0 +1,13 @@
+#!/bin/sh
+# zerovm must be built with lz4 (make COMPRESSION=lz4)
+
+printf "\033[01;38mcompressed channel\033[00m test has"
+
+make clean all>/dev/null
+result=$(cmp output.data input.data 2>&1)
+if [ "" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
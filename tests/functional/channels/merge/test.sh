@@ -0,0 +1,13 @@
+#!/bin/sh
+
+printf "\033[01;38mmerged channel\033[00m test has"
+
+make clean all>/dev/null
+# the messages order is arbitrary, so only the amount of data is checked
+result=$(test $(cat input1.data input2.data | wc -c) -eq $(wc -c < output.data) || echo differ)
+if [ "" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
@@ -0,0 +1,13 @@
+#!/bin/sh
+
+printf "\033[01;38mstriped channel\033[00m test has"
+
+make clean all>/dev/null
+result=$(cmp output.data input.data 2>&1)$(cmp tagged.data input.data 2>&1)
+grep -qE "^(exit state = )?ok$" report4.log || result="tagged reader failed"
+if [ "" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
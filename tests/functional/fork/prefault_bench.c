@@ -0,0 +1,134 @@
+/*
+ * fork + first touch benchmark of the daemon job sessions (see "ForkPrefault"
+ * session option). the template (daemon) dirties the whole heap, the job
+ * (child) writes a quarter of it: page by page (copy-on-write faults) or
+ * after the prefault of the working set. the pagemap scan the recording job
+ * does at exit is measured as well. host program: "make bench"
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 /* linux 5.14 */
+#endif
+#define PAGE 4096
+#define PAGEMAP_CHUNK 512
+#define PAGE_WRITTEN (1ULL << 63 | 1ULL << 56)
+#define RUNS 9
+
+enum Modes {Lazy, Prefault, Scan, ModesNumber};
+static const char *names[] = {"lazy", "prefault", "scan"};
+
+static double Now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* the pagemap scan of the recording job. return the written pages */
+static uint64_t WrittenPages(char *heap, size_t size)
+{
+  uint64_t entries[PAGEMAP_CHUNK];
+  uint64_t first = (uintptr_t)heap / PAGE;
+  uint64_t pages = size / PAGE;
+  uint64_t written = 0;
+  uint64_t i;
+  int pagemap = open("/proc/self/pagemap", O_RDONLY);
+
+  for(i = 0; i < pages; i += PAGEMAP_CHUNK)
+  {
+    uint64_t n = pages - i < PAGEMAP_CHUNK ? pages - i : PAGEMAP_CHUNK;
+    uint64_t j;
+
+    if(pread(pagemap, entries, n * sizeof *entries,
+        (first + i) * sizeof *entries) != n * sizeof *entries) break;
+    for(j = 0; j < n; ++j)
+      written += (entries[j] & PAGE_WRITTEN) == PAGE_WRITTEN;
+  }
+  close(pagemap);
+  return written;
+}
+
+/* fork the job, return the time from the fork to the job end (ms) */
+static double Job(char *heap, size_t size, int mode)
+{
+  size_t ws = size / 4;
+  double start = Now();
+  double result = 0;
+  int fd[2];
+  pid_t pid;
+  size_t i;
+
+  if(pipe(fd) != 0) return -1;
+  pid = fork();
+  if(pid == 0)
+  {
+    if(mode == Prefault)
+      if(madvise(heap, ws, MADV_POPULATE_WRITE) != 0)
+        fprintf(stderr, "prefault is not supported by the kernel\n");
+    for(i = 0; i < ws; i += PAGE)
+      ++heap[i];
+
+    /* the scan is timed alone */
+    result = Now();
+    if(mode == Scan && WrittenPages(heap, size) != ws / PAGE)
+      fprintf(stderr, "pagemap scan missed the written pages\n");
+    result = mode == Scan ? Now() - result : result - start;
+    if(write(fd[1], &result, sizeof result) != sizeof result) _exit(1);
+    _exit(0);
+  }
+
+  if(pid < 0 || read(fd[0], &result, sizeof result) != sizeof result)
+    result = -1;
+  waitpid(pid, NULL, 0);
+  close(fd[0]);
+  close(fd[1]);
+  return result;
+}
+
+static int Compare(const void *a, const void *b)
+{
+  return *(double*)a < *(double*)b ? -1 : *(double*)a > *(double*)b;
+}
+
+int main()
+{
+  size_t sizes[] = {64 << 20, 256 << 20, 1024 << 20};
+  int s;
+
+  printf("median of %d runs (ms): fork + first touch of a quarter of the "
+      "heap, pagemap scan of the whole heap\n", RUNS);
+  for(s = 0; s < sizeof sizes / sizeof *sizes; ++s)
+  {
+    char *heap = mmap(NULL, sizes[s], PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    int mode;
+
+    if(heap == MAP_FAILED) return 1;
+    memset(heap, 1, sizes[s]);
+
+    printf("heap %4zumb:", sizes[s] >> 20);
+    for(mode = 0; mode < ModesNumber; ++mode)
+    {
+      double t[RUNS];
+      int i;
+
+      for(i = 0; i < RUNS; ++i)
+        t[i] = Job(heap, sizes[s], mode);
+      qsort(t, RUNS, sizeof *t, Compare);
+      printf(" %s %.1f", names[mode], t[RUNS / 2]);
+    }
+    printf("\n");
+    munmap(heap, sizes[s]);
+  }
+  return 0;
+}
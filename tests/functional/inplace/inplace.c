@@ -0,0 +1,25 @@
+/*
+ * daemon in place test. the daemon serves the jobs itself ("ResetMemory"
+ * session option). the job given "crash" on stdin faults, the others must
+ * still be served and get the clean reports
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define CMD_SIZE 16
+
+int main()
+{
+  char cmd[CMD_SIZE] = {0};
+
+  /* the jobs start from the entry point and continue here */
+  zvm_fork();
+
+  ZTEST(READ(STDIN, cmd, CMD_SIZE - 1) > 0);
+  if(STRCMP(cmd, "crash") == 0)
+    *(volatile int*)0 = 1;
+
+  /* count errors and exit with it */
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+printf "\033[01;38mdaemon in place\033[00m test has"
+make clean all>/dev/null
+result=$(cat job1.log job3.log | grep "FAILED" | awk '{print $4}')
+grep -qE "^(exit state = )?ok$" job1.report || result="$result job1"
+grep -q "Signal 11" job2.report || result="$result job2"
+grep -qE "^(exit state = )?ok$" job3.report || result="$result job3"
+if [ "" = "$result" ] && [ -s job1.log ] && [ -s job3.log ]; then
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+else
+        echo " \033[01;31mfailed with $result errors\033[00m"
+fi
@@ -0,0 +1,48 @@
+/*
+ * lazy heap test. the heap is opened by 1mb steps ("LazyHeap" session
+ * option) on the access fault or on the channel i/o. the program touches
+ * the heap far past the 1st step and reads the channel into the part not
+ * opened yet. with "overflow" argument it writes past the heap end which
+ * must still fail the session
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define STEP 0x100000 /* see the manifest */
+#define INPUT_SIZE 0x300000 /* see Makefile */
+#define INPUT_BYTE 'z'
+
+int main(int argc, char **argv)
+{
+  char *heap = MANIFEST->heap_ptr;
+  uint32_t size = MANIFEST->heap_size;
+  char *buffer = heap + size / 4 + STEP / 2;
+  int i;
+
+  /* the access past the heap is not opened */
+  if(argc > 1 && STRCMP(argv[1], "overflow") == 0)
+  {
+    heap[ROUNDUP_64K(size)] = 1;
+    FPRINTF(STDERR, "TEST FAILED with 1 errors\n");
+    return 1;
+  }
+
+  /* the heap is much bigger than the step */
+  ZTEST(size > 16 * STEP);
+
+  /* the steps far from the 1st one are opened on access */
+  heap[size / 2] = 1;
+  ZTEST(heap[size / 2] == 1);
+  heap[size - STEP - 1] = 2;
+  ZTEST(heap[size - STEP - 1] == 2);
+  ZTEST(heap[size / 2 + STEP] == 0);
+
+  /* the channel data is read to the several steps nobody touched yet */
+  ZTEST(READ(STDIN, buffer, INPUT_SIZE) == INPUT_SIZE);
+  for(i = 0; i < INPUT_SIZE && buffer[i] == INPUT_BYTE; ++i);
+  ZTEST(i == INPUT_SIZE);
+
+  /* count errors and exit with it */
+  ZREPORT;
+  return 0;
+}
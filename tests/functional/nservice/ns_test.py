@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+# name server load test: "peers" processes register a ring (each node
+# binds for the previous node and connects to the next one) over udp,
+# every 3rd one over tcp. usage: ns_test.py port peers
+import os
+import socket
+import struct
+import sys
+import time
+
+PORT_BASE = 20000
+
+
+def parcel(node, peers):
+    prev = (node - 2) % peers + 1
+    nxt = node % peers + 1
+    return struct.pack('!III', node, 1, 1) \
+        + struct.pack('!IH', prev, PORT_BASE + node) \
+        + struct.pack('!IH', nxt, 0)
+
+
+def receive(s, size):
+    data = b''
+    while len(data) < size:
+        chunk = s.recv(size - len(data))
+        if not chunk:
+            raise IOError('connection closed')
+        data += chunk
+    return data
+
+
+def poll_udp(port, data):
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    delay = 0.1
+    for i in range(6):
+        s.settimeout(delay)
+        s.sendto(data, ('127.0.0.1', port))
+        try:
+            return s.recvfrom(len(data))[0]
+        except socket.timeout:
+            delay *= 2
+    return None
+
+
+def poll_tcp(port, data):
+    s = socket.create_connection(('127.0.0.1', port), 60)
+    s.sendall(struct.pack('!I', len(data)) + data)
+    size = struct.unpack('!I', receive(s, 4))[0]
+    return receive(s, size)
+
+
+def node(port, peers, n):
+    data = parcel(n, peers)
+    reply = None
+    if n % 3:
+        reply = poll_udp(port, data)
+    if reply is None:
+        reply = poll_tcp(port, data)
+    ip, nport = struct.unpack('!4sH', reply[18:24])
+    expected = PORT_BASE + n % peers + 1
+    if len(reply) != len(data) or socket.inet_ntoa(ip) != '127.0.0.1' \
+            or nport != expected:
+        return 1
+    return 0
+
+
+def main():
+    port, peers = int(sys.argv[1]), int(sys.argv[2])
+    children = []
+    for n in range(1, peers + 1):
+        pid = os.fork()
+        if pid == 0:
+            try:
+                code = node(port, peers, n)
+            except Exception:
+                code = 1
+            os._exit(code)
+        children.append(pid)
+    failed = 0
+    for pid in children:
+        if os.waitpid(pid, 0)[1] != 0:
+            failed += 1
+    print(failed)
+
+
+if __name__ == '__main__':
+    main()
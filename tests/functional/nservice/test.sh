@@ -0,0 +1,20 @@
+#!/bin/sh
+
+PEERS=500
+
+printf "\033[01;38mname server\033[00m test has"
+
+make -s -C ../../.. ns_server>/dev/null
+PORT=$(mktemp)
+../../../ns_server $PEERS 0 1 >$PORT &
+SERVER=$!
+sleep 1
+failed=$(python ns_test.py $(cat $PORT) $PEERS)
+wait $SERVER
+result=$?
+rm -f $PORT
+if [ "$failed" != "0" -o $result -ne 0 ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+fi
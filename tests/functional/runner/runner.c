@@ -0,0 +1,58 @@
+/*
+ * runner isolation test. the same program is run as several runner jobs
+ * in one zerovm process. each job checks that nothing is left from the
+ * previous one (r/w data, bss, heap and stack) and then dirties it all
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define DATA_PATTERN 0x5a5a5a5a
+#define DIRT 0xa5
+#define AREA_SIZE 0x10000
+
+static int data = DATA_PATTERN;
+static char bss[AREA_SIZE];
+
+/* return 1 if the area only contains zeroes */
+static int is_clean(const volatile char *area, int size)
+{
+  int i;
+
+  for(i = 0; i < size; ++i)
+    if(area[i] != 0) return 0;
+  return 1;
+}
+
+/* check and dirty the stack deep below the current frame */
+static int __attribute__((noinline)) stack_test()
+{
+  volatile char area[AREA_SIZE * 4];
+  int result = is_clean(area, AREA_SIZE);
+
+  MEMSET((char*)area, DIRT, sizeof area);
+  return result;
+}
+
+int main()
+{
+  char *heap_end = (char*)MANIFEST->heap_ptr + MANIFEST->heap_size - AREA_SIZE;
+
+  /* the initialized data is restored */
+  ZTEST(data == DATA_PATTERN);
+  data = 0;
+
+  /* bss is zeroed */
+  ZTEST(is_clean(bss, sizeof bss));
+  MEMSET(bss, DIRT, sizeof bss);
+
+  /* the heap pages are dropped (the end of the heap is never used by malloc) */
+  ZTEST(is_clean(heap_end, AREA_SIZE));
+  MEMSET(heap_end, DIRT, AREA_SIZE);
+
+  /* the stack is empty */
+  ZTEST(stack_test());
+
+  /* count errors and exit with it */
+  ZREPORT;
+  return 0;
+}
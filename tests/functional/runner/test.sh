@@ -0,0 +1,12 @@
+#!/bin/sh
+
+printf "\033[01;38mrunner\033[00m test has"
+make clean all>/dev/null
+result=$(cat result1.log result2.log result3.log | grep "FAILED" | awk '{print $4}')
+if [ "" = "$result" ] && [ -s result1.log ] && [ -s result2.log ] \
+    && [ -s result3.log ]; then
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+else
+        echo " \033[01;31mfailed with $result errors\033[00m"
+fi